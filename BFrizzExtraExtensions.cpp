@@ -14,614 +14,1078 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/lock_guard.hpp>
 #include <kenshi/Faction.h>
-
-enum itemTypeExtended
+#include <algorithm>
+#include <cstdlib>
+
+#include "ConditionCache.h"
+#include "ConditionOrder.h"
+#include "ConditionRegistry.h"
+#include "Diagnostics.h"
+#include "Frame.h"
+#include "GearSummary.h"
+#include "GenerationTable.h"
+#include "HookStats.h"
+#include "ItemTransfer.h"
+#include "SquadItems.h"
+#include "SquadSnapshot.h"
+#include "SquadStats.h"
+#include "Trace.h"
+#include "VariablePredicates.h"
+#include "VariableStore.h"
+#include "VariableSubscriptions.h"
+#include "WorkerPool.h"
+
+// BUILT IN CONDITIONS
+
+static int readIsSleeping(Character* check, Character* target, int tag)
 {
-	VARIABLE = 1000
-};
+	return check->inSomething == UseStuffState::IN_BED;
+}
 
-// WorldEventStateQuery objects don't store a ref to their gamedata so we need this to get it in WorldEventStateQuery::isTrue
-// I'm currently not doing garbage collection on this but that should just cause a small memory leak when reloading, not enough to care about
-boost::unordered_map<WorldEventStateQuery*, GameData*> queryMap;
-// probably unnecessary  but I don't want to take the risk
-boost::mutex mapLock;
+static int readIsAllyBecauseOfDisguise(Character* check, Character* target, int tag)
+{
+	return check->isAlly(target, true) && !check->isAlly(target, false);
+}
 
-WorldEventStateQuery* (*getFromData_orig)(GameData* d);
-WorldEventStateQuery* getFromData_hook(GameData* d)
+static int readWeaponLevel(Character* check, Character* target, int tag)
 {
-	WorldEventStateQuery* query = getFromData_orig(d);
+	// Note: value is -1 if unarmed
+	return getGearSummary(check).weaponLevel();
+}
 
-	// lock + add to map
-	boost::lock_guard<boost::mutex> lock(mapLock);
-	queryMap.emplace(query, d);
+// check if any equipped armour meets condition
+// Note: value is -1 if unarmoured
+static bool armourLevelEquals(const ConditionType& type, Character* check, Character* target, int tag, int value)
+{
+	const GearSummary& gear = getGearSummary(check);
+	if (gear.armourLevels.empty())
+		return value == -1;
+	return std::binary_search(gear.armourLevels.begin(), gear.armourLevels.end(), value);
+}
 
-	return query;
+static bool armourLevelLessThan(const ConditionType& type, Character* check, Character* target, int tag, int value)
+{
+	const GearSummary& gear = getGearSummary(check);
+	return (gear.armourLevels.empty() ? -1 : gear.minArmourLevel) < value;
 }
 
-enum ExtendedDialogConditionEnum
+static bool armourLevelMoreThan(const ConditionType& type, Character* check, Character* target, int tag, int value)
 {
-	DC_IS_SLEEPING = 1000,
-	DC_HAS_SHORT_TERM_TAG,
-	DC_IS_ALLY_BECAUSE_OF_DISGUISE,
-	DC_STAT_LEVEL_UNMODIFIED,
-	DC_STAT_LEVEL_MODIFIED,
-	DC_WEAPON_LEVEL,
-	DC_ARMOUR_LEVEL
-};
+	const GearSummary& gear = getGearSummary(check);
+	return (gear.armourLevels.empty() ? -1 : gear.maxArmourLevel) > value;
+}
 
-static const float SQUAD_CHECK_RADIUS = 900.0f;
+static int readShortTermTag(Character* check, Character* target, int tag)
+{
+	return check->getCharacterMemoryTag(target, (CharacterPerceptionTags_ShortTerm)tag);
+}
 
-// TODO remove?
-static bool DialogCompare(int val1, int val2, ComparisonEnum compareBy)
+static int readStatUnmodified(Character* check, Character* target, int tag)
 {
+	return (int)check->getStats()->getStat((StatsEnumerated)tag, true);
+}
 
-	if (compareBy == ComparisonEnum::CE_EQUALS && val1 == val2)
-		return true;
-	if (compareBy == ComparisonEnum::CE_LESS_THAN && val1 < val2)
-		return true;
-	if (compareBy == ComparisonEnum::CE_MORE_THAN && val1 > val2)
-		return true;
+static int readStatModified(Character* check, Character* target, int tag)
+{
+	return (int)check->getStats()->getStat((StatsEnumerated)tag, false);
+}
 
-	return false;
+// whole squad stat checks compare a column of the squad's stats at once
+template<bool Unmodified, int Comparison>
+static bool anySquadStatLevel(const ConditionType& type, ActivePlatoon* platoon, const Ogre::Vector3& position, Character* target, int tag, int value)
+{
+	return anySquadStat(platoon, position, tag, Unmodified, Comparison, value);
 }
 
-static bool DialogCompare(int val1, DialogLineData::DialogCondition* condition)
+static void registerBuiltinConditions()
 {
+	registerStaticCondition<&readIsSleeping>(DC_IS_SLEEPING, "is sleeping", CONDITION_HOOK_CHECK_CONDITIONS, 1.0f);
+	registerStaticCondition<&readIsAllyBecauseOfDisguise>(DC_IS_ALLY_BECAUSE_OF_DISGUISE, "is ally because of disguise", CONDITION_HOOK_CHECK_CONDITIONS, 4.0f);
+	registerStaticCondition<&readWeaponLevel>(DC_WEAPON_LEVEL, "weapon level", CONDITION_HOOK_CHECK_CONDITIONS, 3.0f);
+	const ConditionEvaluator armourLevel[COMPARISON_COUNT] = { &armourLevelEquals, &armourLevelLessThan, &armourLevelMoreThan };
+	registerCondition(DC_ARMOUR_LEVEL, "armour level", CONDITION_HOOK_CHECK_CONDITIONS, 3.0f, armourLevel);
+
+	registerStaticCondition<&readShortTermTag>(DC_HAS_SHORT_TERM_TAG, "has short term tag", CONDITION_HOOK_CHECK_TAGS, 4.0f);
+	registerStaticCondition<&readStatUnmodified>(DC_STAT_LEVEL_UNMODIFIED, "stat level unmodified", CONDITION_HOOK_CHECK_TAGS, 2.0f);
+	registerStaticCondition<&readStatModified>(DC_STAT_LEVEL_MODIFIED, "stat level modified", CONDITION_HOOK_CHECK_TAGS, 2.0f);
+	const SquadConditionEvaluator squadStatUnmodified[COMPARISON_COUNT] = {
+		&anySquadStatLevel<true, 0>,
+		&anySquadStatLevel<true, 1>,
+		&anySquadStatLevel<true, 2>
+	};
+	registerSquadEvaluators(DC_STAT_LEVEL_UNMODIFIED, squadStatUnmodified);
+	const SquadConditionEvaluator squadStatModified[COMPARISON_COUNT] = {
+		&anySquadStatLevel<false, 0>,
+		&anySquadStatLevel<false, 1>,
+		&anySquadStatLevel<false, 2>
+	};
+	registerSquadEvaluators(DC_STAT_LEVEL_MODIFIED, squadStatModified);
+}
 
-	if (condition->compareBy == ComparisonEnum::CE_EQUALS && val1 == condition->value)
-		return true;
-	if (condition->compareBy == ComparisonEnum::CE_LESS_THAN && val1 < condition->value)
-		return true;
-	if (condition->compareBy == ComparisonEnum::CE_MORE_THAN && val1 > condition->value)
+static bool checkCondition(Character* characterCheck, Character* characterTarget, DialogLineData::DialogCondition* condition)
+{
+	// vanilla conditions and conditions handled by checkTags aren't our problem
+	const ConditionType* type = getConditionType(condition->key);
+	if (!type || type->hook != CONDITION_HOOK_CHECK_CONDITIONS)
 		return true;
+	return evaluateCondition(*type, condition->compareBy, characterCheck, characterTarget, condition->tag, condition->value);
+}
 
+static bool neverTrue(const ConditionType& type, Character* check, Character* target, int tag, int value)
+{
 	return false;
 }
 
-static bool checkCondition(Character* characterCheck, Character* characterTarget, DialogLineData::DialogCondition* condition)
+// true if any member passes
+static bool checkSquad(const std::vector<Character*>& squad, const ConditionType& type, ConditionEvaluator evaluate, Character* target, int tag, int value)
 {
-	switch (condition->key)
+	for (size_t i = 0; i < squad.size(); ++i)
 	{
-		case DC_IS_SLEEPING:
-			if (!DialogCompare(characterCheck->inSomething == UseStuffState::IN_BED, condition))
-				return false;
-			break;
-		case DC_IS_ALLY_BECAUSE_OF_DISGUISE:
-			if (!DialogCompare((characterCheck->isAlly(characterTarget, true) && !characterCheck->isAlly(characterTarget, false)), condition))
-				return false;
-			break;
-		case DC_WEAPON_LEVEL:
-		{
-			// Note: value is -1 if unarmed
-			// this check often doesn't check equipped weapons on back
-			Weapon* weapon = characterCheck->getCurrentWeapon();
-			// this seems to be the same
-			if (!weapon)
-				weapon = characterCheck->getThePreferredWeapon();
-			int level = weapon == nullptr ? -1 : weapon->getLevel();
-			if (!weapon)
-			{
-				lektor<InventorySection*> sections;
-				characterCheck->inventory->getAllSectionsOfType(sections, AttachSlot::ATTACH_WEAPON);
-				for (int i = 0; i < sections.size(); ++i)
-				{
-					const Ogre::vector<InventorySection::SectionItem>::type& items = sections[i]->getItems();
-					for (int j = 0; j < items.size(); ++j)
-						if (weapon = dynamic_cast<Weapon*>(items[j].item))
-							level = std::max(level, weapon->getLevel());
-				}
-
-				// cleanup
-				free(sections.stuff);
-			}
+		if (evaluate(type, squad[i], target, tag, value))
+			return true;
+	}
+	return false;
+}
 
-			if (!DialogCompare(level, condition))
-				return false;
-			break;
-		}
-		case DC_ARMOUR_LEVEL:
-		{
-			// Note: value is -1 if unarmoured
-			lektor<Item*> armour;
-			armour.maxSize = 0;
-			armour.count = 0;
-			armour.stuff = nullptr;
-			characterCheck->getInventory()->getEquippedArmour(armour);
-			bool hasMatch = false;
-			// check if any equipped armour meets condition
-			for (int i = 0; i < armour.size(); ++i)
-				if (DialogCompare(armour[i]->getLevel(), condition))
-					hasMatch = true;
-			// unarmoured
-			if (armour.size() == 0)
-				hasMatch = DialogCompare(-1, condition);
-			// garbage collect
-			if (armour.stuff)
-				free(armour.stuff);
-			// return false if no armour matches
-			if (!hasMatch)
-				return false;
-			break;
-		}
+// checkTags conditions decoded from a line's GameData
+// decoding the references by string on every call is slow on dialogue-heavy packages, so each line is compiled once
+struct TagConditionOp
+{
+	const ConditionType* type;
+	// specialised for the comparison
+	ConditionEvaluator evaluate;
+	// whole squad fast path if the condition has one
+	SquadConditionEvaluator evaluateSquad;
+	TalkerEnum who;
+	int tag;
+	int value;
+};
+
+struct VariableConditionOp
+{
+	// VariablePredicates index, passes if the variable has no value
+	int predicate;
+};
+
+// "squad has item", the target's squad around me holds at least count of item
+struct ItemConditionOp
+{
+	GameData* item;
+	int count;
+};
+
+// _doActions effects, in the order they're applied
+enum LineActionEnum
+{
+	LA_TAKE_ITEM,
+	LA_TAKE_ITEM_FROM_SQUAD,
+	LA_DESTROY_ITEM,
+	LA_DESTROY_ITEM_FROM_SQUAD,
+	LA_SET_VARIABLE,
+	LA_ADD_TO_VARIABLE,
+	LA_COUNT
+};
+
+// objectReferences names for LineActionEnum
+static const std::string lineActionNames[LA_COUNT] = {
+	"take item",
+	"take item from squad",
+	"destroy item",
+	"destroy item from squad",
+	"set variable",
+	"add to variable"
+};
+
+struct LineActionOp
+{
+	LineActionEnum action;
+	// item or variable
+	GameData* target;
+	// VariableStore slot for variable effects, -1 otherwise
+	int slot;
+	int value;
+};
+
+struct CompiledLine
+{
+	std::vector<TagConditionOp> tagConditions;
+	std::vector<VariableConditionOp> variableConditions;
+	std::vector<ItemConditionOp> itemConditions;
+	// over tagConditions, variableConditions then itemConditions
+	ConditionOrder tagConditionOrder;
+	// false if checkTags can go straight to vanilla
+	bool hasConditions;
+
+	// bit per LineActionEnum present on the line
+	unsigned int actionMask;
+	// in application order
+	std::vector<LineActionOp> actions;
+
+	// compiledLineEpoch when compiled
+	uint32_t epoch;
+};
+
+// keyed by GameData as DialogLineData objects are recreated from it, entries from before a save was loaded are
+// recompiled when next used
+boost::unordered_map<GameData*, CompiledLine*> compiledLines;
+boost::mutex compiledLinesLock;
+// lines replaced by a recompile, readers may still hold them until the next load
+std::vector<CompiledLine*> retiredLines;
+// lock-free view of compiledLines, lines are checked on every candidate dialogue option
+GenerationTable<GameData, CompiledLine> lineTable;
+boost::atomic<uint32_t> compiledLineEpoch(0);
+
+// objectReferences names of the variable conditions, the same for lines and world states
+static const std::string variableConditionNames[3] = {
+	"variable equals",
+	"variable less than",
+	"variable greater than"
+};
+
+// a reference's target and first value
+struct SourceReference
+{
+	GameData* ptr;
+	// VariableStore slot for variable references, -1 otherwise
+	int slot;
+	int value;
+	// stringID of a variable without a value, for the diagnostic
+	std::string missingName;
+};
+
+// checkTags condition read from a "conditions" reference
+struct SourceCondition
+{
+	const ConditionType* type;
+	int compareBy;
+	int who;
+	int tag;
+	int value;
+};
+
+// What compiling a line or world state reads from its GameData, decoded by readSource so compileLine and
+// compileWorldState don't look anything up by string.
+struct CompileSource
+{
+	GameData* data;
+	std::vector<SourceCondition> conditions;
+	// by variableConditionNames, hasVariables is set if the reference list exists, even if it's empty
+	std::vector<SourceReference> variables[3];
+	bool hasVariables[3];
+	std::vector<SourceReference> items;
+	// by LineActionEnum
+	std::vector<SourceReference> actions[LA_COUNT];
+	bool hasActions[LA_COUNT];
+};
+
+// returns false if data has no references called name
+static bool readReferences(GameData* data, const std::string& name, bool variables, std::vector<SourceReference>& out)
+{
+	ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter = data->objectReferences.find(name);
+	if (iter == data->objectReferences.end())
+		return false;
+
+	for (Ogre::vector<GameDataReference>::type::iterator refIter = iter->second.begin(); refIter != iter->second.end(); ++refIter)
+	{
+		SourceReference reference;
+		reference.ptr = refIter->ptr;
+		reference.slot = variables ? variableStore.getSlot(refIter->ptr) : -1;
+		reference.value = refIter->values[0];
+		if (variables && !variableStore.hasValue(reference.slot))
+			reference.missingName = refIter->ptr->stringID;
+		out.push_back(reference);
 	}
 	return true;
 }
 
-bool (*DialogLineData_checkConditions_orig)(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap);
-bool DialogLineData_checkConditions_hook(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap)
+// game thread only, world states only have variable conditions
+static void readSource(GameData* data, bool line, CompileSource& source)
 {
-	for (DialogLineData::DialogCondition** condition = thisptr->conditions.begin(); condition < thisptr->conditions.end(); ++condition)
+	source.data = data;
+	for (int condition = 0; condition < 3; ++condition)
+		source.hasVariables[condition] = readReferences(data, variableConditionNames[condition], true, source.variables[condition]);
+	for (int action = 0; action < LA_COUNT; ++action)
+		source.hasActions[action] = false;
+	if (!line)
+		return;
+
+	static const std::string conditionsName("conditions");
+	ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter = data->objectReferences.find(conditionsName);
+	if (iter != data->objectReferences.end())
 	{
-		// T_ME behaviour - do I have memory tag for target
-		Character* characterCheck = dialog->getCharacter();
-		// I'm sometimes getting NO TARGET?
-		Character* characterTarget = target;
-
-		if ((*condition)->who != TalkerEnum::T_ME && (*condition)->who != TalkerEnum::T_WHOLE_SQUAD)
+		for (Ogre::vector<GameDataReference>::type::iterator conditionIter = iter->second.begin(); conditionIter != iter->second.end(); ++conditionIter)
 		{
-			// swap
-			Character* temp = characterTarget;
-			characterTarget = characterCheck;
-			characterCheck = temp;
+			ogre_unordered_map<std::string, int>::type& idata = conditionIter->ptr->idata;
+			ogre_unordered_map<std::string, int>::type::iterator nameIter = idata.find("condition name");
+			if (nameIter == idata.end())
+				continue;
+
+			// vanilla conditions and conditions handled by checkConditions aren't our problem
+			const ConditionType* type = getConditionType(nameIter->second);
+			if (!type || type->hook != CONDITION_HOOK_CHECK_TAGS)
+				continue;
+
+			ogre_unordered_map<std::string, int>::type::iterator compareIter = idata.find("compare by");
+			ogre_unordered_map<std::string, int>::type::iterator whoIter = idata.find("who");
+			ogre_unordered_map<std::string, int>::type::iterator tagIter = idata.find("tag");
+
+			SourceCondition condition;
+			condition.type = type;
+			condition.compareBy = compareIter == idata.end() ? (int)ComparisonEnum::CE_EQUALS : compareIter->second;
+			condition.who = whoIter == idata.end() ? (int)TalkerEnum::T_ME : whoIter->second;
+			condition.tag = tagIter == idata.end() ? 0 : tagIter->second;
+			condition.value = conditionIter->values[0];
+			source.conditions.push_back(condition);
 		}
+	}
 
-		if (!characterCheck)
-		{
-			ErrorLog("NO SPEAKER");
-			break;
-		}
+	static const std::string itemsName("squad has item");
+	readReferences(data, itemsName, false, source.items);
+	for (int action = 0; action < LA_COUNT; ++action)
+		source.hasActions[action] = readReferences(data, lineActionNames[action], action == LA_SET_VARIABLE || action == LA_ADD_TO_VARIABLE, source.actions[action]);
+}
 
-		if (!characterTarget)
-		{
-			ErrorLog("NO TARGET");
-			// TODO is this a problem?
-			//break;
-		}
+static void compileVariableConditions(const CompileSource& source, int condition, ComparisonEnum compareBy, CompiledLine* compiled)
+{
+	const std::vector<SourceReference>& variables = source.variables[condition];
+	for (size_t i = 0; i < variables.size(); ++i)
+	{
+		VariableConditionOp op;
+		op.predicate = variablePredicates.add(variables[i].slot, compareBy, variables[i].value, true);
+		addVariableDependent(variables[i].slot, source.data);
+		compiled->variableConditions.push_back(op);
+	}
+}
 
-		if ((*condition)->who == TalkerEnum::T_WHOLE_SQUAD)
-		{
-			// with above branch, characterCheck will be "me"
-			ActivePlatoon* activePlatoon = characterCheck->getPlatoon();
-			lektor<RootObject*> characters;
-			// couldn't find T_WHOLE_SQUAD radius but interjection radius is similar and appears to be 900
-			activePlatoon->getCharactersInArea(characters, characterCheck->getPosition(), SQUAD_CHECK_RADIUS, false);
-
-			// if any
-			bool found = false;
-			for (int i = 0; i < characters.size(); ++i)
-			{
-				Character* squadChar = dynamic_cast<Character*>(characters[i]);
-				if (squadChar)
-				{
-					if (checkCondition(squadChar, characterTarget, *condition))
-						// condition is met -  move on to the next condition
-						found = true;
-					//break;
-				}
-			}
+// relative cost of a condition for ConditionOrder
+static float conditionCost(const ConditionType* type, TalkerEnum who)
+{
+	float cost = type->cost;
+	// proximity scan plus a check per squad member
+	if (who == TalkerEnum::T_WHOLE_SQUAD)
+		cost = 16.0f + cost * 8.0f;
+	return cost;
+}
 
-			// cleanup
-			if (characters.stuff)
-				free(characters.stuff);
+static const float VARIABLE_CONDITION_COST = 1.0f;
+// proximity scan plus a pass over the squad's inventories, once per frame
+static const float ITEM_CONDITION_COST = 24.0f;
 
-			if (!found)
-				return false;
+static DiagnosticSite missingReferencesDiagnostic("Missing references for ");
+
+static CompiledLine* compileLine(const CompileSource& source)
+{
+	CompiledLine* compiled = new CompiledLine();
+
+	for (size_t i = 0; i < source.conditions.size(); ++i)
+	{
+		const SourceCondition& condition = source.conditions[i];
+		const int comparison = comparisonIndex((ComparisonEnum)condition.compareBy);
+
+		TagConditionOp op;
+		op.type = condition.type;
+		op.evaluate = comparison < 0 ? &neverTrue : condition.type->evaluators[comparison];
+		op.evaluateSquad = comparison < 0 ? nullptr : condition.type->squadEvaluators[comparison];
+		op.who = (TalkerEnum)condition.who;
+		op.tag = condition.tag;
+		op.value = condition.value;
+		compiled->tagConditions.push_back(op);
+	}
+
+	compileVariableConditions(source, 0, ComparisonEnum::CE_EQUALS, compiled);
+	compileVariableConditions(source, 1, ComparisonEnum::CE_LESS_THAN, compiled);
+	compileVariableConditions(source, 2, ComparisonEnum::CE_MORE_THAN, compiled);
+
+	for (size_t i = 0; i < source.items.size(); ++i)
+	{
+		ItemConditionOp op;
+		op.item = source.items[i].ptr;
+		// a reference left at 0 means any
+		op.count = std::max(1, source.items[i].value);
+		compiled->itemConditions.push_back(op);
+	}
+
+	std::vector<float> costs;
+	for (size_t i = 0; i < compiled->tagConditions.size(); ++i)
+		costs.push_back(conditionCost(compiled->tagConditions[i].type, compiled->tagConditions[i].who));
+	for (size_t i = 0; i < compiled->variableConditions.size(); ++i)
+		costs.push_back(VARIABLE_CONDITION_COST);
+	for (size_t i = 0; i < compiled->itemConditions.size(); ++i)
+		costs.push_back(ITEM_CONDITION_COST);
+	compiled->tagConditionOrder.init(costs.empty() ? nullptr : &costs[0], (int)costs.size());
+	compiled->hasConditions = !costs.empty();
+
+	compiled->actionMask = 0;
+	for (int action = 0; action < LA_COUNT; ++action)
+	{
+		if (!source.hasActions[action])
+			continue;
+
+		const std::vector<SourceReference>& references = source.actions[action];
+		if (references.size() == 0)
+		{
+			reportDiagnostic(missingReferencesDiagnostic, lineActionNames[action].c_str());
+			continue;
 		}
-		else
+
+		compiled->actionMask |= 1 << action;
+		for (size_t i = 0; i < references.size(); ++i)
 		{
-			if (!checkCondition(characterCheck, characterTarget, *condition))
-				return false;
+			LineActionOp op;
+			op.action = (LineActionEnum)action;
+			op.target = references[i].ptr;
+			op.slot = references[i].slot;
+			op.value = references[i].value;
+			compiled->actions.push_back(op);
 		}
 	}
-	return DialogLineData_checkConditions_orig(thisptr, dialog, target, isWordswap);
+
+	return compiled;
 }
 
-bool checkTag(ExtendedDialogConditionEnum dialogCondition, Character* conditionCheck, Character* conditionTarget, ComparisonEnum compareBy, int tag, int value)
+// compiledLinesLock must be held, iter is compiledLines.find(lineData)
+static void storeCompiledLine(GameData* lineData, CompiledLine* compiled, boost::unordered_map<GameData*, CompiledLine*>::iterator iter)
 {
-	if (dialogCondition == ExtendedDialogConditionEnum::DC_HAS_SHORT_TERM_TAG)
+	if (iter != compiledLines.end())
 	{
-		return DialogCompare(conditionCheck->getCharacterMemoryTag(conditionTarget, (CharacterPerceptionTags_ShortTerm)tag), value, compareBy);
+		retiredLines.push_back(iter->second);
+		iter->second = compiled;
 	}
-	// both of these can be done together
-	else if (dialogCondition == ExtendedDialogConditionEnum::DC_STAT_LEVEL_MODIFIED
-		|| dialogCondition == ExtendedDialogConditionEnum::DC_STAT_LEVEL_UNMODIFIED)
+	else
 	{
-		// swap between enum behaviour
-		bool unmodified = dialogCondition == ExtendedDialogConditionEnum::DC_STAT_LEVEL_UNMODIFIED;
+		compiledLines.emplace(lineData, compiled);
+	}
+	lineTable.insert(lineData, compiled);
+}
 
-		float stat = conditionCheck->getStats()->getStat((StatsEnumerated)tag, unmodified);
-		return DialogCompare((int)stat, value, compareBy);
+static CompiledLine* getCompiledLine(GameData* lineData)
+{
+	const uint32_t epoch = compiledLineEpoch.load(boost::memory_order_relaxed);
+	CompiledLine* compiled = lineTable.find(lineData);
+	if (compiled && compiled->epoch == epoch)
+		return compiled;
+
+	boost::lock_guard<boost::mutex> lock(compiledLinesLock);
+	boost::unordered_map<GameData*, CompiledLine*>::iterator iter = compiledLines.find(lineData);
+	if (iter != compiledLines.end() && iter->second->epoch == epoch)
+	{
+		// dropped from the table as stale, or compiled by another thread
+		lineTable.insert(lineData, iter->second);
+		return iter->second;
 	}
 
-	// not our problem
-	return true;
+	CompileSource source;
+	readSource(lineData, true, source);
+	compiled = compileLine(source);
+	compiled->epoch = epoch;
+	storeCompiledLine(lineData, compiled, iter);
+	return compiled;
 }
 
-bool (*checkTags_orig)(DialogLineData* thisptr, Character* me, Character* target);
-bool checkTags_hook(DialogLineData* thisptr, Character* me, Character* target)
+// called when a save is loaded, nothing should be evaluating lines at this point
+// lines are recompiled as they are next used
+static void invalidateCompiledLines()
+{
+	boost::lock_guard<boost::mutex> lock(compiledLinesLock);
+	// replaced lines are no longer in the table
+	for (size_t i = 0; i < retiredLines.size(); ++i)
+		delete retiredLines[i];
+	retiredLines.clear();
+
+	compiledLineEpoch.fetch_add(1, boost::memory_order_relaxed);
+	lineTable.nextGeneration();
+}
+
+// checkConditions handles our keys, vanilla whole squad conditions also need a squad in range
+static bool isDialogCondition(const DialogLineData::DialogCondition* condition)
+{
+	const ConditionType* type = getConditionType(condition->key);
+	return (type && type->hook == CONDITION_HOOK_CHECK_CONDITIONS) || condition->who == TalkerEnum::T_WHOLE_SQUAD;
+}
+
+static bool checkDialogCondition(DialogLineData::DialogCondition* condition, Character* me, Character* target, HookScope& scope)
 {
-	// TAG CONDITIONS
-	for (int i = 0; i < thisptr->conditions.size(); ++i)
+	// T_ME behaviour - do I have memory tag for target
+	Character* characterCheck = me;
+	Character* characterTarget = target;
+
+	if (condition->who != TalkerEnum::T_ME && condition->who != TalkerEnum::T_WHOLE_SQUAD)
 	{
-		// optimization - only do a full check if there's an actual extended condition
-		if (thisptr->conditions[i]->key == ExtendedDialogConditionEnum::DC_HAS_SHORT_TERM_TAG
-			|| thisptr->conditions[i]->key == DC_STAT_LEVEL_UNMODIFIED
-			|| thisptr->conditions[i]->key == DC_STAT_LEVEL_MODIFIED)
-		{
-			ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter = thisptr->data->objectReferences.find("conditions");
+		// swap
+		Character* temp = characterTarget;
+		characterTarget = characterCheck;
+		characterCheck = temp;
+	}
 
-			if (iter != thisptr->data->objectReferences.end())
-			{
-				for (int i = 0; i < iter->second.size(); ++i)
-				{
-					ExtendedDialogConditionEnum dialogCondition = (ExtendedDialogConditionEnum)iter->second[i].ptr->idata.find("condition name")->second;
-					ComparisonEnum compareBy = (ComparisonEnum)iter->second[i].ptr->idata.find("compare by")->second;
-					TalkerEnum who = (TalkerEnum)iter->second[i].ptr->idata.find("who")->second;
-					int tag = iter->second[i].ptr->idata.find("tag")->second;
-					int value = iter->second[i].values[0];
-
-					// T_ME behaviour - do I have tag for target
-					Character* conditionCheck = me;
-					// Note: target can sometimes be null, seems to happen on interjection nodes
-					Character* conditionTarget = target;
-					if (who != TalkerEnum::T_ME && who != TalkerEnum::T_WHOLE_SQUAD)
-					{
-						// swap
-						Character* temp = conditionTarget;
-						conditionTarget = conditionCheck;
-						conditionCheck = temp;
-					}
-
-					if (who == TalkerEnum::T_WHOLE_SQUAD)
-					{
-						ActivePlatoon* platoon = conditionCheck->getPlatoon();
-						if (platoon)
-						{
-							lektor<RootObject*> characters;
-							// couldn't find T_WHOLE_SQUAD radius but interjection radius is similar and appears to be 900
-							platoon->getCharactersInArea(characters, conditionCheck->getPosition(), SQUAD_CHECK_RADIUS, false);
-
-							bool found = false;
-							for (int i = 0; i < characters.size(); ++i)
-							{
-								Character* squadChar = dynamic_cast<Character*>(characters[i]);
-								// if any
-								if (squadChar)
-								{
-									if (checkTag(dialogCondition, squadChar, conditionTarget, compareBy, tag, value))
-										// condition is met -  move on to the next condition
-										found = true;
-									//break;
-								}
-							}
-
-							// cleanup
-							if (characters.stuff)
-								free(characters.stuff);
-
-							if (!found)
-								return false;
-						}
-					}
-					else
-					{
-						if (!checkTag(dialogCondition, conditionCheck, conditionTarget, compareBy, tag, value))
-							return false;
-					}
-				}
-			}
-			// above loop should check all conditions
-			break;
-		}
+	if (condition->who == TalkerEnum::T_WHOLE_SQUAD)
+	{
+		SquadScanScope squadScope(scope);
+		// with above branch, characterCheck will be "me"
+		const std::vector<Character*>& squad = getSquadMembers(characterCheck->getPlatoon(), characterCheck->getPosition());
+
+		// vanilla conditions are met by the first member
+		const ConditionType* type = getConditionType(condition->key);
+		if (!type || type->hook != CONDITION_HOOK_CHECK_CONDITIONS)
+			return !squad.empty();
+		const int comparison = comparisonIndex(condition->compareBy);
+		if (comparison < 0)
+			return false;
+		if (type->squadEvaluators[comparison])
+			return type->squadEvaluators[comparison](*type, characterCheck->getPlatoon(), characterCheck->getPosition(), characterTarget, condition->tag, condition->value);
+		return checkSquad(squad, *type, type->evaluators[comparison], characterTarget, condition->tag, condition->value);
 	}
 
-	// VARIABLES
-	ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter = thisptr->getGameData()->objectReferences.find("variable equals");
-	if (iter != thisptr->getGameData()->objectReferences.end())
+	return checkCondition(characterCheck, characterTarget, condition);
+}
+
+bool (*DialogLineData_checkConditions_orig)(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap);
+
+static DiagnosticSite noTargetDiagnostic("NO TARGET");
+static DiagnosticSite noSpeakerDiagnostic("NO SPEAKER");
+
+static bool evaluateConditions(DialogLineData* thisptr, Dialogue* dialog, Character* me, Character* target, bool isWordswap, HookScope& scope)
+{
+	// I'm sometimes getting NO TARGET?
+	if (!target)
+		reportDiagnostic(noTargetDiagnostic);
+
+	// a condition checking a missing speaker ends evaluation, so only conditions before it apply
+	int end = thisptr->conditions.size();
+	if (!me || !target)
 	{
-		for (Ogre::vector<GameDataReference>::type::iterator variableIter = iter->second.begin(); variableIter != iter->second.end(); ++variableIter)
+		for (int i = 0; i < end; ++i)
 		{
-			ogre_unordered_map<std::string, int>::type::iterator valueIter = variableIter->ptr->idata.find("value");
-			if (valueIter != variableIter->ptr->idata.end() && !(valueIter->second == variableIter->values[0]))
-				return false;
+			TalkerEnum who = thisptr->conditions[i]->who;
+			if (!(who == TalkerEnum::T_ME || who == TalkerEnum::T_WHOLE_SQUAD ? me : target))
+			{
+				reportDiagnostic(noSpeakerDiagnostic);
+				end = i;
+				break;
+			}
 		}
 	}
 
-	iter = thisptr->getGameData()->objectReferences.find("variable less than");
-	if (iter != thisptr->getGameData()->objectReferences.end())
+	// single character checks first, so a failing one skips the whole squad scans
+	// looking up a per-line order costs more than these checks, pass rates are only tracked for checkTags
+	bool hasSquadCondition = false;
+	for (int i = 0; i < end; ++i)
 	{
-		for (Ogre::vector<GameDataReference>::type::iterator variableIter = iter->second.begin(); variableIter != iter->second.end(); ++variableIter)
-		{
-			ogre_unordered_map<std::string, int>::type::iterator valueIter = variableIter->ptr->idata.find("value");
-			if (valueIter != variableIter->ptr->idata.end() && !(valueIter->second < variableIter->values[0]))
-				return false;
-		}
+		DialogLineData::DialogCondition* condition = thisptr->conditions[i];
+		if (condition->who == TalkerEnum::T_WHOLE_SQUAD)
+			hasSquadCondition = true;
+		else if (isDialogCondition(condition) && !checkDialogCondition(condition, me, target, scope))
+			return false;
 	}
 
-	iter = thisptr->getGameData()->objectReferences.find("variable greater than");
-	if (iter != thisptr->getGameData()->objectReferences.end())
+	if (hasSquadCondition)
 	{
-		for (Ogre::vector<GameDataReference>::type::iterator variableIter = iter->second.begin(); variableIter != iter->second.end(); ++variableIter)
+		for (int i = 0; i < end; ++i)
 		{
-			ogre_unordered_map<std::string, int>::type::iterator valueIter = variableIter->ptr->idata.find("value");
-			if (valueIter != variableIter->ptr->idata.end() && !(valueIter->second > variableIter->values[0]))
+			DialogLineData::DialogCondition* condition = thisptr->conditions[i];
+			if (condition->who == TalkerEnum::T_WHOLE_SQUAD && !checkDialogCondition(condition, me, target, scope))
 				return false;
 		}
 	}
 
-	// VANILLA TAGS
-	return checkTags_orig(thisptr, me, target);
+	return traceVanilla(DialogLineData_checkConditions_orig(thisptr, dialog, target, isWordswap));
 }
 
-// returns num items taken
-int takeItems(Character* giver, Character* taker, GameData* itemData, int count)
+static bool checkConditionsCached(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap)
 {
-	int countTaken = 0;
-	while (countTaken < count)
-	{
-		Item* item = giver->inventory->getItem(itemData);
+	HookScope scope(HOOK_CHECK_CONDITIONS, thisptr->getGameData());
+
+	Character* me = dialog->getCharacter();
+	const ConditionCacheKind kind = isWordswap ? CC_CHECK_CONDITIONS_WORDSWAP : CC_CHECK_CONDITIONS;
+	const int cached = findConditionResult(thisptr, dialog, me, target, kind);
+	if (cached >= 0 && !verifyConditionResults)
+		return scope.result(cached != 0);
+
+	const bool result = evaluateConditions(thisptr, dialog, me, target, isWordswap, scope);
+	if (cached >= 0 && result != (cached != 0))
+		reportConditionResultMismatch(thisptr->getGameData(), kind, cached != 0);
+	storeConditionResult(thisptr, dialog, me, target, kind, result);
+	return scope.result(result);
+}
 
-		// stop when the character no longer has instances of the item
-		if (item == nullptr)
-			return countTaken;
+bool DialogLineData_checkConditions_hook(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap)
+{
+	if (!traceEnabled)
+		return checkConditionsCached(thisptr, dialog, target, isWordswap);
 
-		const int countRemaining = count - countTaken;
-		// if stack has more items than we're removing, split and return
-		if (item->quantity > countRemaining)
-		{
-			// part of stack is moved, split by creating new instance
-			item->quantity -= countRemaining;
-			Item* newItem = ou->theFactory->copyItem(item);
-			newItem->quantity = countRemaining;
-			taker->giveItem(newItem, true, false);
-			return count;
-		}
+	traceCheckConditions(thisptr, dialog->getCharacter(), target, isWordswap);
+	const bool result = checkConditionsCached(thisptr, dialog, target, isWordswap);
+	traceResult(result);
+	return result;
+}
+
+static bool checkTagCondition(const TagConditionOp& op, Character* me, Character* target, HookScope& scope)
+{
+	// T_ME behaviour - do I have tag for target
+	Character* conditionCheck = me;
+	// Note: target can sometimes be null, seems to happen on interjection nodes
+	Character* conditionTarget = target;
+	if (op.who != TalkerEnum::T_ME && op.who != TalkerEnum::T_WHOLE_SQUAD)
+	{
+		// swap
+		Character* temp = conditionTarget;
+		conditionTarget = conditionCheck;
+		conditionCheck = temp;
+	}
+	// orders adapt, so an earlier condition can't be relied on to have failed on a missing speaker first
+	if (!conditionCheck)
+	{
+		reportDiagnostic(noSpeakerDiagnostic);
+		return false;
+	}
+
+	if (op.who == TalkerEnum::T_WHOLE_SQUAD)
+	{
+		ActivePlatoon* platoon = conditionCheck->getPlatoon();
+		if (!platoon)
+			return true;
 
-		// whole stack is moved
-		countTaken += item->quantity;
+		SquadScanScope squadScope(scope);
+		if (op.evaluateSquad)
+			return op.evaluateSquad(*op.type, platoon, conditionCheck->getPosition(), conditionTarget, op.tag, op.value);
+		const std::vector<Character*>& squad = getSquadMembers(platoon, conditionCheck->getPosition());
 
-		giver->dropItem(item);
-		taker->giveItem(item, true, false);
+		return checkSquad(squad, *op.type, op.evaluate, conditionTarget, op.tag, op.value);
 	}
 
-	// count is reached
-	return count;
+	return op.evaluate(*op.type, conditionCheck, conditionTarget, op.tag, op.value);
 }
 
-// returns num items destroyed
-int destroyItems(Character* target, GameData* itemData, int count)
+static bool checkVariableCondition(const VariableConditionOp& op)
 {
-	while (true)
-	{
-		Item* item = target->inventory->getItem(itemData);
+	return variablePredicates.passed(op.predicate);
+}
 
-		// stop when the character no longer has instances of the item
-		if (item == nullptr)
-			return count;
+static bool checkItemCondition(const ItemConditionOp& op, Character* me, Character* target, HookScope& scope)
+{
+	// same squad "take item from squad" takes from
+	if (!me || !target)
+		return false;
+	SquadScanScope squadScope(scope);
+	return getSquadItemCount(target->getPlatoon(), me->getPosition(), op.item) >= op.count;
+}
 
-		if (item->quantity > count)
+bool (*checkTags_orig)(DialogLineData* thisptr, Character* me, Character* target);
+
+static bool evaluateTags(DialogLineData* thisptr, Character* me, Character* target, HookScope& scope)
+{
+	CompiledLine* compiled = getCompiledLine(thisptr->getGameData());
+	if (!compiled->hasConditions)
+		return traceVanilla(checkTags_orig(thisptr, me, target));
+
+	// TAG CONDITIONS and VARIABLES, cheapest and most likely to fail first
+	ConditionOrder& conditionOrder = compiled->tagConditionOrder;
+	const int tagCount = (int)compiled->tagConditions.size();
+	const int variableEnd = tagCount + (int)compiled->variableConditions.size();
+	const uint64_t order = conditionOrder.load();
+	for (int i = 0; i < conditionOrder.size(); ++i)
+	{
+		const int index = conditionOrder.at(order, i);
+		const bool passed = index < tagCount
+			? checkTagCondition(compiled->tagConditions[index], me, target, scope)
+			: index < variableEnd
+				? checkVariableCondition(compiled->variableConditions[index - tagCount])
+				: checkItemCondition(compiled->itemConditions[index - variableEnd], me, target, scope);
+		conditionOrder.record(index, passed);
+		if (!passed)
 		{
-			item->quantity -= count;
-			return count;
+			conditionOrder.evaluated();
+			return false;
 		}
+	}
+	conditionOrder.evaluated();
 
-		count -= item->quantity;
+	// VANILLA TAGS
+	return traceVanilla(checkTags_orig(thisptr, me, target));
+}
 
-		// get rid of inventory references or something, no idea if this is needed but it seems like a good idea
-		target->dropItem(item);
-		ou->destroy(item, false, "Destroy item event");
-	}
-	return count;
+static bool checkTagsCached(DialogLineData* thisptr, Character* me, Character* target)
+{
+	HookScope scope(HOOK_CHECK_TAGS, thisptr->getGameData());
+
+	const int cached = findConditionResult(thisptr, nullptr, me, target, CC_CHECK_TAGS);
+	if (cached >= 0 && !verifyConditionResults)
+		return scope.result(cached != 0);
+
+	const bool result = evaluateTags(thisptr, me, target, scope);
+	if (cached >= 0 && result != (cached != 0))
+		reportConditionResultMismatch(thisptr->getGameData(), CC_CHECK_TAGS, cached != 0);
+	storeConditionResult(thisptr, nullptr, me, target, CC_CHECK_TAGS, result);
+	return scope.result(result);
 }
 
-void doRefAction(const std::string& action, Ogre::vector<GameDataReference>::type& ref, Dialogue* thisptr)
+bool checkTags_hook(DialogLineData* thisptr, Character* me, Character* target)
 {
-	if (ref.size() == 0)
-	{
-		ErrorLog("Missing references for \"" + action + "\"");
-	}
+	if (!traceEnabled)
+		return checkTagsCached(thisptr, me, target);
+
+	traceCheckTags(thisptr, me, target);
+	const bool result = checkTagsCached(thisptr, me, target);
+	traceResult(result);
+	return result;
+}
 
-	if (action == "take item" || action == "take item from squad")
+void doRefAction(const LineActionOp& op, Dialogue* thisptr)
+{
+	if (op.action == LA_TAKE_ITEM || op.action == LA_TAKE_ITEM_FROM_SQUAD)
 	{
-		for (Ogre::vector<GameDataReference>::type::iterator itemIter = ref.begin(); itemIter != ref.end(); ++itemIter)
+		Character* giver = thisptr->getConversationTarget().getCharacter();
+		Character* taker = thisptr->me;
+		if (giver != nullptr && taker != nullptr)
 		{
-			Character* giver = thisptr->getConversationTarget().getCharacter();
-			Character* taker = thisptr->me;
-			if (giver != nullptr && taker != nullptr)
+			if (op.action == LA_TAKE_ITEM)
+			{
+				takeItems(&giver, 1, taker, op.target, op.value);
+			}
+			else
 			{
-				if (action == "take item")
-				{
-					takeItems(giver, taker, itemIter->ptr, itemIter->values[0]);
-				}
-				else
-				{
-					ActivePlatoon* activePlatoon = giver->getPlatoon();
-					lektor<RootObject*> characters;
-					// couldn't find T_WHOLE_SQUAD radius but interjection radius is similar and appears to be 900
-					activePlatoon->getCharactersInArea(characters, taker->getPosition(), SQUAD_CHECK_RADIUS, false);
-
-					int itemsLeft = itemIter->values[0];
-					for (int c = 0; c < characters.size(); ++c)
-					{
-						Character* squadChar = dynamic_cast<Character*>(characters[c]);
-						if (squadChar)
-							itemsLeft -= takeItems(giver, taker, itemIter->ptr, itemsLeft);
-						if (itemsLeft == 0)
-							break;
-					}
-
-					// cleanup
-					free(characters.stuff);
-				}
+				// stacks are collected from the members holding any then moved in one go
+				const SquadItemCount* items = findSquadItems(giver->getPlatoon(), taker->getPosition(), op.target);
+				if (items)
+					takeItems(&items->holders[0], items->holders.size(), taker, op.target, std::min(op.value, items->total));
 			}
 		}
 	}
-	else if (action == "destroy item" || action == "destroy item from squad")
+	else if (op.action == LA_DESTROY_ITEM || op.action == LA_DESTROY_ITEM_FROM_SQUAD)
 	{
-
-		for (Ogre::vector<GameDataReference>::type::iterator itemIter = ref.begin(); itemIter != ref.end(); ++itemIter)
+		Character* target = thisptr->getConversationTarget().getCharacter();
+		if (target != nullptr)
 		{
-			Character* target = thisptr->getConversationTarget().getCharacter();
-			if (target != nullptr)
+			// destroyed once the line's other effects are queued
+			if (op.action == LA_DESTROY_ITEM)
 			{
-				if (action == "destroy item")
-				{
-					destroyItems(target, itemIter->ptr, itemIter->values[0]);
-				}
-				else
-				{
-					ActivePlatoon* activePlatoon = target->getPlatoon();
-					lektor<RootObject*> characters;
-					// couldn't find T_WHOLE_SQUAD radius but interjection radius is similar and appears to be 900
-					activePlatoon->getCharactersInArea(characters, target->getPosition(), SQUAD_CHECK_RADIUS, false);
-
-					int itemsLeft = itemIter->values[0];
-					for (int c = 0; c < characters.size(); ++c)
-					{
-						Character* squadChar = dynamic_cast<Character*>(characters[c]);
-						if (squadChar)
-							itemsLeft -= destroyItems(target, itemIter->ptr, itemsLeft);
-						if (itemsLeft == 0)
-							break;
-					}
-
-					// cleanup
-					free(characters.stuff);
-				}
+				queueItemDestroy(&target, 1, op.target, op.value);
+			}
+			else
+			{
+				const SquadItemCount* items = findSquadItems(target->getPlatoon(), target->getPosition(), op.target);
+				if (items)
+					queueItemDestroy(&items->holders[0], items->holders.size(), op.target, std::min(op.value, items->total));
 			}
 		}
 	}
+
+	// inventories may have changed
+	invalidateGearSummaries();
+	invalidateSquadItems();
+	// equipment changes modified stats
+	invalidateSquadStats();
+	invalidateConditionResults();
 }
 
-bool checkWorldStateVariable(const std::string &condition, Ogre::vector<GameDataReference>::type& ref)
+// world state variable conditions decoded from the query's GameData
+struct CompiledWorldState
 {
-	for (Ogre::vector<GameDataReference>::type::iterator variableIter = ref.begin(); variableIter != ref.end(); ++variableIter)
-	{
-		int targetVal = variableIter->values[0];
-		ogre_unordered_map<std::string, int>::type::iterator valueIter = variableIter->ptr->idata.find("value");
+	GameData* data;
+	// VariablePredicates indices
+	std::vector<int> variablePredicates;
+	// a condition list had no usable variable
+	bool neverTrue;
+	// compiledLineEpoch when compiled
+	uint32_t epoch;
+
+	// result of variablePredicates as (VariableStore version << 1) | result, 0 if not evaluated
+	// world states are polled constantly but variables rarely change
+	mutable boost::atomic<uint64_t> memo;
+};
+
+// world states are compiled when a query is created, or ahead of that by the precompile pass, and again after a load
+boost::unordered_map<GameData*, CompiledWorldState*> compiledWorldStates;
+boost::mutex compiledWorldStatesLock;
+// world states dropped by the last load, queries from before it may still hold them until the next one
+std::vector<CompiledWorldState*> retiredWorldStates;
 
-		if (valueIter != variableIter->ptr->idata.end())
+static DiagnosticSite missingValueDiagnostic("WorldStates: Variable is missing value: ");
+static DiagnosticSite invalidWorldStateDiagnostic("Invalid world state condition: ");
+
+static void compileWorldStateVariable(const CompileSource& source, int condition, ComparisonEnum compareBy, CompiledWorldState* compiled)
+{
+	if (!source.hasVariables[condition])
+		return;
+
+	// only the first variable with a value is checked
+	const std::vector<SourceReference>& variables = source.variables[condition];
+	for (size_t i = 0; i < variables.size(); ++i)
+	{
+		if (variableStore.hasValue(variables[i].slot))
 		{
-			if(condition == "variable equals")
-				return targetVal == valueIter->second;
-			if (condition == "variable less than")
-				return targetVal < valueIter->second;
-			if (condition == "variable greater than")
-				return targetVal > valueIter->second;
+			compiled->variablePredicates.push_back(::variablePredicates.add(variables[i].slot, compareBy, variables[i].value, false));
+			addVariableDependent(variables[i].slot, source.data);
+			return;
 		}
 		else
 		{
-			ErrorLog("WorldStates: Variable is missing value");
+			reportDiagnostic(missingValueDiagnostic, variables[i].missingName.c_str());
 		}
 	}
-	ErrorLog("Invalid world state condition: " + condition);
-	return false;
+	reportDiagnostic(invalidWorldStateDiagnostic, variableConditionNames[condition].c_str());
+	compiled->neverTrue = true;
+}
+
+static CompiledWorldState* compileWorldState(const CompileSource& source)
+{
+	CompiledWorldState* compiled = new CompiledWorldState();
+	compiled->data = source.data;
+	compiled->neverTrue = false;
+	compiled->epoch = compiledLineEpoch.load(boost::memory_order_relaxed);
+	compiled->memo.store(0, boost::memory_order_relaxed);
+	// world states compare the stored value against the variable, so less/greater than are the other way round to dialogue
+	compileWorldStateVariable(source, 0, ComparisonEnum::CE_EQUALS, compiled);
+	compileWorldStateVariable(source, 1, ComparisonEnum::CE_MORE_THAN, compiled);
+	compileWorldStateVariable(source, 2, ComparisonEnum::CE_LESS_THAN, compiled);
+	return compiled;
+}
+
+static CompiledWorldState* getCompiledWorldState(GameData* stateData)
+{
+	boost::lock_guard<boost::mutex> lock(compiledWorldStatesLock);
+	boost::unordered_map<GameData*, CompiledWorldState*>::iterator iter = compiledWorldStates.find(stateData);
+	if (iter != compiledWorldStates.end())
+		return iter->second;
+
+	CompileSource source;
+	readSource(stateData, false, source);
+	CompiledWorldState* compiled = compileWorldState(source);
+	compiledWorldStates.emplace(stateData, compiled);
+	return compiled;
+}
+
+static bool isWorldStateCompiled(GameData* stateData)
+{
+	boost::lock_guard<boost::mutex> lock(compiledWorldStatesLock);
+	return compiledWorldStates.find(stateData) != compiledWorldStates.end();
+}
+
+// called when a save is loaded after invalidateCompiledLines, the data may be at a reused address
+static void invalidateCompiledWorldStates()
+{
+	boost::lock_guard<boost::mutex> lock(compiledWorldStatesLock);
+	for (size_t i = 0; i < retiredWorldStates.size(); ++i)
+		delete retiredWorldStates[i];
+	retiredWorldStates.clear();
+
+	for (boost::unordered_map<GameData*, CompiledWorldState*>::iterator iter = compiledWorldStates.begin(); iter != compiledWorldStates.end(); ++iter)
+		retiredWorldStates.push_back(iter->second);
+	compiledWorldStates.clear();
+}
+
+// WorldEventStateQuery objects don't store a ref to their gamedata so we need this to get it in WorldEventStateQuery::isTrue
+// isTrue is polled constantly so lookups are lock-free, entries from previous loads are reclaimed by GenerationTable
+GenerationTable<WorldEventStateQuery, CompiledWorldState> queryTable;
+
+WorldEventStateQuery* (*getFromData_orig)(GameData* d);
+WorldEventStateQuery* getFromData_hook(GameData* d)
+{
+	HookScope scope(HOOK_GET_FROM_DATA);
+	WorldEventStateQuery* query = getFromData_orig(d);
+
+	// replaces any stale entry for a dead query at the same address
+	if (query)
+		queryTable.insert(query, getCompiledWorldState(d));
+
+	return query;
 }
 
 bool (*WorldEventStateQuery_isTrue_orig)(WorldEventStateQuery* thisptr);
-bool WorldEventStateQuery_isTrue_hook(WorldEventStateQuery* thisptr)
+static DiagnosticSite queryWithoutDataDiagnostic("WorldStates: Query has no GameData");
+static bool evaluateWorldState(WorldEventStateQuery* thisptr)
 {
+	HookScope scope(HOOK_IS_TRUE);
+
 	// regular conditions
-	bool state = WorldEventStateQuery_isTrue_orig(thisptr);
+	bool state = traceVanilla(WorldEventStateQuery_isTrue_orig(thisptr));
 
-	GameData* gameData;
-	// prevent race conditions
+	const CompiledWorldState* compiled = queryTable.find(thisptr);
+	if (!compiled)
+	{
+		// shouldn't happen unless the query outlived two loads without being polled
+		reportDiagnostic(queryWithoutDataDiagnostic);
+		return scope.result(state);
+	}
+	if (compiled->epoch != compiledLineEpoch.load(boost::memory_order_relaxed))
 	{
-		boost::lock_guard<boost::mutex> lock(mapLock);
-		gameData = queryMap[thisptr];
+		// the query outlived a load, its world state has been dropped
+		CompiledWorldState* current = getCompiledWorldState(compiled->data);
+		queryTable.insert(thisptr, current);
+		compiled = current;
 	}
 
 	// our new conditions
-	ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter = gameData->objectReferences.find("variable equals");
-	if (iter != gameData->objectReferences.end() && !checkWorldStateVariable("variable equals", iter->second))
-		return false;
-
-	iter = gameData->objectReferences.find("variable less than");
-	if (iter != gameData->objectReferences.end() && !checkWorldStateVariable("variable less than", iter->second))
-		return false;
-
-	iter = gameData->objectReferences.find("variable greater than");
-	if (iter != gameData->objectReferences.end() && !checkWorldStateVariable("variable greater than", iter->second))
-		return false;
+	if (compiled->neverTrue)
+		return scope.result(false);
+
+	// version is read before the bitmap so a concurrent write always invalidates the result
+	const uint32_t version = variableStore.getVersion();
+	const uint64_t memo = compiled->memo.load(boost::memory_order_relaxed);
+	if ((memo >> 1) == version)
+		return scope.result((memo & 1) ? state : false);
+
+	const bool result = compiled->variablePredicates.empty()
+		|| ::variablePredicates.allPassed(&compiled->variablePredicates[0], (int)compiled->variablePredicates.size());
+	compiled->memo.store(((uint64_t)version << 1) | (result ? 1 : 0), boost::memory_order_relaxed);
+	return scope.result(result ? state : false);
+}
 
-	return state;
+bool WorldEventStateQuery_isTrue_hook(WorldEventStateQuery* thisptr)
+{
+	// queries without GameData aren't traced
+	const CompiledWorldState* compiled = traceEnabled ? queryTable.find(thisptr) : nullptr;
+	if (!compiled)
+		return evaluateWorldState(thisptr);
+
+	traceIsTrue(compiled->data);
+	const bool result = evaluateWorldState(thisptr);
+	traceResult(result);
+	return result;
 }
 
-void changeWorldStateVariable(const std::string& action, Ogre::vector<GameDataReference>::type& ref)
+static DiagnosticSite missingParameterDiagnostic("Missing parameter: value for ");
+
+void changeWorldStateVariable(const LineActionOp& op)
 {
-	if (ref.size() == 0)
+	if (variableStore.hasValue(op.slot))
 	{
-		ErrorLog("Missing references for \"" + action + "\"");
+		const int oldValue = variableStore.get(op.slot);
+		if (op.action == LA_SET_VARIABLE)
+			variableStore.set(op.slot, op.value);
+		else if (op.action == LA_ADD_TO_VARIABLE)
+			variableStore.add(op.slot, op.value);
+		invalidateConditionResults();
+		notifyVariableChanged(op.slot, op.target, oldValue, variableStore.get(op.slot));
 	}
-
-	for (Ogre::vector<GameDataReference>::type::iterator variableIter = ref.begin(); variableIter != ref.end(); ++variableIter)
+	else
 	{
-		ogre_unordered_map<std::string, int>::type::iterator valueIter = variableIter->ptr->idata.find("value");
+		reportDiagnostic(missingParameterDiagnostic, op.target->stringID.c_str());
+	}
+}
 
-		if (valueIter != variableIter->ptr->idata.end())
+void (*_doActions_orig)(Dialogue* thisptr, DialogLineData* dialogLine);
+static void doActions(Dialogue* thisptr, DialogLineData* dialogLine)
+{
+	HookScope scope(HOOK_DO_ACTIONS, dialogLine->getGameData());
+	const CompiledLine* compiled = getCompiledLine(dialogLine->getGameData());
+
+	// most lines don't have any of our effects
+	if (compiled->actionMask != 0)
+	{
+		for (std::vector<LineActionOp>::const_iterator op = compiled->actions.begin(); op != compiled->actions.end(); ++op)
 		{
-			if(action == "set variable")
-				valueIter->second = variableIter->values[0];
-			else if (action == "add to variable")
-				valueIter->second += variableIter->values[0];
+			// VARIABLE EFFECTS
+			if (op->action == LA_SET_VARIABLE || op->action == LA_ADD_TO_VARIABLE)
+				changeWorldStateVariable(*op);
+			// DIALOGUE EFFECTS
+			else
+				doRefAction(*op, thisptr);
 		}
-		else
+
+		// the conversation checks lines again this frame, and vanilla effects may check items too
+		if (flushItemDestroys())
 		{
-			ErrorLog("Missing parameter: value");
+			invalidateGearSummaries();
+			invalidateSquadItems();
+			invalidateSquadStats();
+			invalidateConditionResults();
 		}
 	}
+
+	// continue
+	_doActions_orig(thisptr, dialogLine);
+
+	// vanilla effects change tags, relations and stats
+	invalidateSquadStats();
+	invalidateConditionResults();
 }
 
-void (*_doActions_orig)(Dialogue* thisptr, DialogLineData* dialogLine);
 void _doActions_hook(Dialogue* thisptr, DialogLineData* dialogLine)
 {
-	// DIALOGUE EFFECTS
-	ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter = dialogLine->getGameData()->objectReferences.find("take item");
-	if (iter != dialogLine->getGameData()->objectReferences.end())
-		doRefAction("take item", iter->second, thisptr);
+	if (!traceEnabled)
+	{
+		doActions(thisptr, dialogLine);
+		return;
+	}
+
+	traceDoActions(thisptr, dialogLine);
+	doActions(thisptr, dialogLine);
+	traceResult(false);
+}
+
+// Compiles every dialogue line and world state of a loaded save a slice per frame, so the first interjection after a
+// load doesn't pay for decoding references. Lines reached by the game first are compiled on use as before and skipped
+// here.
+class Precompiler
+{
+public:
+	Precompiler()
+		: nextLine(0), nextWorldState(0)
+	{
+	}
 
-	iter = dialogLine->getGameData()->objectReferences.find("take item from squad");
-	if (iter != dialogLine->getGameData()->objectReferences.end())
-		doRefAction("take item from squad", iter->second, thisptr);
+	// takes the lists collected by VariableStore::rebuildRegistry, nothing is read from them until update
+	void start(std::vector<GameData*>& loadedLines, std::vector<GameData*>& loadedWorldStates)
+	{
+		stop();
+		lines.swap(loadedLines);
+		worldStates.swap(loadedWorldStates);
+	}
 
-	iter = dialogLine->getGameData()->objectReferences.find("destroy item");
-	if (iter != dialogLine->getGameData()->objectReferences.end())
-		doRefAction("destroy item", iter->second, thisptr);
+	// called once a frame on the game thread, compiles at most PRECOMPILE_SLICE lines and world states
+	void update()
+	{
+		const uint32_t epoch = compiledLineEpoch.load(boost::memory_order_relaxed);
+		size_t compiled = 0;
+		for (; nextLine < lines.size() && compiled < PRECOMPILE_SLICE; ++nextLine)
+		{
+			const CompiledLine* line = lineTable.find(lines[nextLine]);
+			if (line && line->epoch == epoch)
+				continue;
+			getCompiledLine(lines[nextLine]);
+			++compiled;
+		}
+		// otherwise compiled when the game creates their query
+		for (; nextWorldState < worldStates.size() && compiled < PRECOMPILE_SLICE; ++nextWorldState)
+		{
+			if (isWorldStateCompiled(worldStates[nextWorldState]))
+				continue;
+			getCompiledWorldState(worldStates[nextWorldState]);
+			++compiled;
+		}
+	}
 
-	iter = dialogLine->getGameData()->objectReferences.find("destroy item from squad");
-	if (iter != dialogLine->getGameData()->objectReferences.end())
-		doRefAction("destroy item from squad", iter->second, thisptr);
+	// drops anything not compiled yet, call before game data is replaced
+	void stop()
+	{
+		lines.clear();
+		worldStates.clear();
+		nextLine = 0;
+		nextWorldState = 0;
+	}
 
-	// VARIABLE EFFECTS
-	iter = dialogLine->getGameData()->objectReferences.find("set variable");
-	if (iter != dialogLine->getGameData()->objectReferences.end())
-		changeWorldStateVariable("set variable", iter->second);
+private:
+	// compiling a line is about 4.5 microseconds, mostly cache misses decoding references, so this is about 0.07 ms a frame
+	static const size_t PRECOMPILE_SLICE = 16;
 
-	iter = dialogLine->getGameData()->objectReferences.find("add to variable");
-	if (iter != dialogLine->getGameData()->objectReferences.end())
-		changeWorldStateVariable("add to variable", iter->second);
+	std::vector<GameData*> lines;
+	std::vector<GameData*> worldStates;
+	size_t nextLine;
+	size_t nextWorldState;
+};
 
-	// continue
-	_doActions_orig(thisptr, dialogLine);
-}
+static Precompiler precompiler;
 
 // this is a convenient place to hook into the save system
 // not 100% sure this is the best way to save data - data here is written to "quick.save"
 void (*saveGameState_orig)(FactionManager* thisptr, GameDataContainer* container);
 void saveGameState_hook(FactionManager* thisptr, GameDataContainer* container)
 {
-	// find VARIABLE gamedata
-	ogre_unordered_map<std::string, GameData*>::type::iterator iter = ou->gamedata.gamedataSID.begin();
-	for (; iter != ou->gamedata.gamedataSID.end(); ++iter)
-	{
-		if (iter->second->type == (itemType)VARIABLE)
-		{
-			// create new GameData in save
-			GameData* newGameData2 = container->createNewData(iter->second->type, iter->second->stringID, iter->second->name);
-			if (newGameData2)
-				newGameData2->updateFrom(iter->second, false);
-		}
-	}
+	HookScope scope(HOOK_SAVE_GAME_STATE);
+
+	// only variables that differ from their defaults are written
+	variableStore.saveTo(container);
+
 	saveGameState_orig(thisptr, container);
 }
 
@@ -631,22 +1095,88 @@ void saveGameState_hook(FactionManager* thisptr, GameDataContainer* container)
 void (*loadAllPlatoons_orig)(GameWorld* thisptr);
 void loadAllPlatoons_hook(GameWorld* thisptr)
 {
+	HookScope scope(HOOK_LOAD_ALL_PLATOONS);
+
+	// compiled lines from the pass would point at the game data being replaced
+	precompiler.stop();
+
 	loadAllPlatoons_orig(thisptr);
 
-	ogre_unordered_map<std::string, GameData*>::type::iterator iter = ou->savedata.gamedataSID.begin();
-	for (; iter != ou->savedata.gamedataSID.end(); ++iter)
-	{
-		if (iter->second->type == (itemType)VARIABLE)
-		{
-			ou->gamedata.updateData(iter->second, false);
-		}
-	}
+	// the loaded game data may have added, removed or renamed variables, the same scan collects what to precompile
+	std::vector<GameData*> lines;
+	std::vector<GameData*> worldStates;
+	variableStore.rebuildRegistry(&lines, &worldStates);
+	// references may have changed with the loaded data
+	invalidateCompiledLines();
+	invalidateCompiledWorldStates();
+	// refilled as lines and world states compile, including by the precompile pass
+	clearVariableDependents();
+	// queries from before the load can now be reclaimed
+	queryTable.nextGeneration();
+	// characters from before the load are gone
+	clearItemDestroys();
+	invalidateSquadItems();
+	invalidateSquadStats();
+	invalidateConditionResults();
+
+	variableStore.loadFromSave();
+	// nothing is evaluating while a save loads
+	variablePredicates.releaseRetired();
+	// the replayer restarts from the loaded values
+	traceVariables();
+
+	// lines were invalidated above, compile them again a slice per frame from the first frame of the loaded game
+	precompiler.start(lines, worldStates);
+}
+
+boost::atomic<uint32_t> currentFrame(0);
+
+void (*mainLoop_GPUSensitiveStuff_orig)(GameWorld* thisptr, float time);
+void mainLoop_GPUSensitiveStuff_hook(GameWorld* thisptr, float time)
+{
+	// invalidates per-frame caches
+	currentFrame.fetch_add(1, boost::memory_order_relaxed);
+
+	precompiler.update();
+
+	if (hookStatsEnabled)
+		updateHookStats(time);
+
+	mainLoop_GPUSensitiveStuff_orig(thisptr, time);
 }
 
 __declspec(dllexport) void startPlugin()
 {
+	// errors from the hooks are written from a background thread
+	startDiagnostics();
+
+	registerBuiltinConditions();
+
+	// whole squad checks and large variable batches are split across this many threads, 0 keeps them on the game thread
+	const char* workerThreads = getenv("BFRIZZ_WORKER_THREADS");
+	int workerCount = (int)boost::thread::hardware_concurrency() - 1;
+	if (workerThreads && *workerThreads)
+		workerCount = atoi(workerThreads);
+	workerPool.start(std::max(0, std::min(workerCount, 7)));
+
+	// set to a file path to profile the hooks, written every 10 seconds
+	const char* statsPath = getenv("BFRIZZ_HOOK_STATS");
+	if (statsPath && *statsPath)
+		enableHookStats(statsPath, 10.0f);
+	// re-evaluates cached condition results and logs any that are stale
+	const char* verifyCache = getenv("BFRIZZ_VERIFY_CONDITION_CACHE");
+	if (verifyCache && *verifyCache)
+		verifyConditionResults = true;
+	// saves modified variables as one record, older versions of the plugin can't read these saves
+	const char* compactSaves = getenv("BFRIZZ_COMPACT_SAVES");
+	if (compactSaves && *compactSaves)
+		variableStore.setCompactSaves(true);
+	// set to a file path to record dialogue and world state evaluations for bench/bfrizz_replay, slows dialogue a lot
+	const char* tracePath = getenv("BFRIZZ_TRACE");
+	if (tracePath && *tracePath && !startTrace(tracePath))
+		ErrorLog("Trace: could not write " + std::string(tracePath));
+
 	// there's no obvious way to track which GameData is associated with which WorldEventStateQuery/List so we make our own
-	// NOTE: there's no garage collection...
 	if (KenshiLib::SUCCESS != KenshiLib::AddHook(KenshiLib::GetRealAddress(&WorldEventStateQuery::getFromData), &getFromData_hook, &getFromData_orig))
 		DebugLog("WorldStates: Could not hook function!");
 	if (KenshiLib::SUCCESS != KenshiLib::AddHook(KenshiLib::GetRealAddress(&WorldEventStateQuery::isTrue), &WorldEventStateQuery_isTrue_hook, &WorldEventStateQuery_isTrue_orig))
@@ -661,4 +1191,6 @@ __declspec(dllexport) void startPlugin()
 		DebugLog("WorldStates: Could not hook function!");
 	if (KenshiLib::SUCCESS != KenshiLib::AddHook(KenshiLib::GetRealAddress(&GameWorld::loadAllPlatoons), &loadAllPlatoons_hook, &loadAllPlatoons_orig))
 		DebugLog("WorldStates: Could not hook function!");
+	if (KenshiLib::SUCCESS != KenshiLib::AddHook(KenshiLib::GetRealAddress(&GameWorld::_NV_mainLoop_GPUSensitiveStuff), &mainLoop_GPUSensitiveStuff_hook, &mainLoop_GPUSensitiveStuff_orig))
+		ErrorLog("Dialogue Extensions: could not install hook!");
 }
\ No newline at end of file
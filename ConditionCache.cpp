@@ -0,0 +1,110 @@
+#include "ConditionCache.h"
+#include "Diagnostics.h"
+#include "Frame.h"
+
+#include <stdint.h>
+#include <kenshi/GameData.h>
+#include <boost/thread/tss.hpp>
+
+bool verifyConditionResults = false;
+
+namespace
+{
+	boost::atomic<uint32_t> resultEpoch(0);
+
+	// power of two
+	const uint32_t CACHE_SIZE = 256;
+
+	struct CachedResult
+	{
+		DialogLineData* line;
+		Dialogue* dialog;
+		Character* me;
+		Character* target;
+		uint32_t frame;
+		uint32_t epoch;
+		uint8_t kind;
+		uint8_t result;
+	};
+
+	// direct mapped, a colliding store replaces the entry
+	struct ResultCache
+	{
+		CachedResult entries[CACHE_SIZE];
+
+		ResultCache()
+		{
+			for (uint32_t i = 0; i < CACHE_SIZE; ++i)
+				entries[i].line = nullptr;
+		}
+	};
+
+	boost::thread_specific_ptr<ResultCache> resultCache;
+
+	uint32_t slotFor(DialogLineData* line, Dialogue* dialog, Character* me, Character* target, ConditionCacheKind kind)
+	{
+		uintptr_t hash = (uintptr_t)line >> 4;
+		hash = hash * 31 + ((uintptr_t)dialog >> 4);
+		hash = hash * 31 + ((uintptr_t)me >> 4);
+		hash = hash * 31 + ((uintptr_t)target >> 4);
+		hash = hash * 31 + kind;
+		return ((uint32_t)(hash * 2654435761u) >> 24) & (CACHE_SIZE - 1);
+	}
+}
+
+int findConditionResult(DialogLineData* line, Dialogue* dialog, Character* me, Character* target, ConditionCacheKind kind)
+{
+	ResultCache* cache = resultCache.get();
+	if (!cache)
+		return -1;
+
+	const CachedResult& entry = cache->entries[slotFor(line, dialog, me, target, kind)];
+	if (entry.line != line || entry.dialog != dialog || entry.me != me || entry.target != target || entry.kind != kind
+		|| entry.frame != getFrame() || entry.epoch != resultEpoch.load(boost::memory_order_relaxed))
+		return -1;
+	return entry.result;
+}
+
+void storeConditionResult(DialogLineData* line, Dialogue* dialog, Character* me, Character* target, ConditionCacheKind kind, bool result)
+{
+	ResultCache* cache = resultCache.get();
+	if (!cache)
+	{
+		cache = new ResultCache();
+		resultCache.reset(cache);
+	}
+
+	CachedResult& entry = cache->entries[slotFor(line, dialog, me, target, kind)];
+	entry.line = line;
+	entry.dialog = dialog;
+	entry.me = me;
+	entry.target = target;
+	entry.kind = (uint8_t)kind;
+	entry.frame = getFrame();
+	entry.epoch = resultEpoch.load(boost::memory_order_relaxed);
+	entry.result = result ? 1 : 0;
+}
+
+void invalidateConditionResults()
+{
+	resultEpoch.fetch_add(1, boost::memory_order_relaxed);
+}
+
+// per kind and cached result so the summaries say which
+static DiagnosticSite staleCheckConditionsFalse("Condition cache: stale checkConditions result (cached false) for ");
+static DiagnosticSite staleCheckConditionsTrue("Condition cache: stale checkConditions result (cached true) for ");
+static DiagnosticSite staleWordswapFalse("Condition cache: stale checkConditions (wordswap) result (cached false) for ");
+static DiagnosticSite staleWordswapTrue("Condition cache: stale checkConditions (wordswap) result (cached true) for ");
+static DiagnosticSite staleCheckTagsFalse("Condition cache: stale checkTags result (cached false) for ");
+static DiagnosticSite staleCheckTagsTrue("Condition cache: stale checkTags result (cached true) for ");
+
+static DiagnosticSite* const staleResultDiagnostics[][2] = {
+	{ &staleCheckConditionsFalse, &staleCheckConditionsTrue },
+	{ &staleWordswapFalse, &staleWordswapTrue },
+	{ &staleCheckTagsFalse, &staleCheckTagsTrue }
+};
+
+void reportConditionResultMismatch(GameData* line, ConditionCacheKind kind, bool cached)
+{
+	reportDiagnostic(*staleResultDiagnostics[kind][cached ? 1 : 0], line->stringID.c_str());
+}
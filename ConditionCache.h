@@ -0,0 +1,31 @@
+#pragma once
+
+class Character;
+class Dialogue;
+class DialogLineData;
+class GameData;
+
+// hook results cached by ConditionCache
+enum ConditionCacheKind
+{
+	CC_CHECK_CONDITIONS,
+	CC_CHECK_CONDITIONS_WORDSWAP,
+	CC_CHECK_TAGS
+};
+
+// The engine checks the same line for the same pair of characters many times in a row while picking
+// interjections and wordswaps, so checkConditions/checkTags results are reused within a frame.
+// checkConditions results include the vanilla conditions, which depend on the dialogue, so it's part of the key,
+// checkTags passes nullptr.
+// Results are dropped on the next frame and whenever invalidateConditionResults is called, which must happen after
+// anything conditions read changes outside the game's own update (variables, inventories, dialogue effects).
+// Cached per thread in a small direct mapped table.
+
+// returns 1 or 0 for a cached result, -1 if there isn't one
+int findConditionResult(DialogLineData* line, Dialogue* dialog, Character* me, Character* target, ConditionCacheKind kind);
+void storeConditionResult(DialogLineData* line, Dialogue* dialog, Character* me, Character* target, ConditionCacheKind kind, bool result);
+void invalidateConditionResults();
+
+// when set every cached result is also re-evaluated, and mismatches are logged
+extern bool verifyConditionResults;
+void reportConditionResultMismatch(GameData* line, ConditionCacheKind kind, bool cached);
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdint.h>
+#include <boost/atomic.hpp>
+
+// Evaluation order for a list of side-effect free conditions that must all pass
+// Pass rates are tracked per condition and the list is periodically re-sorted so cheap conditions that usually fail
+// run first. Lines are rejected as early as possible and the result doesn't depend on the order.
+// Lists longer than MAX_CONDITIONS keep their authoring order.
+class ConditionOrder
+{
+public:
+	// indices are packed 4 bits each into one word so the order can be swapped atomically
+	static const int MAX_CONDITIONS = 16;
+	// evaluations between re-sorts
+	static const uint32_t REORDER_INTERVAL = 256;
+	static const uint32_t DECAY_THRESHOLD = 1 << 16;
+
+	ConditionOrder()
+		: count(0), order(0), evaluations(0)
+	{
+	}
+
+	// costs are relative estimates, until pass rates are known conditions are ordered by cost alone
+	// must be called before the order is shared
+	void init(const float* conditionCosts, int conditionCount)
+	{
+		count = conditionCount;
+		for (int i = 0; i < count && i < MAX_CONDITIONS; ++i)
+		{
+			costs[i] = conditionCosts[i];
+			tried[i].store(0, boost::memory_order_relaxed);
+			passed[i].store(0, boost::memory_order_relaxed);
+		}
+		evaluations.store(0, boost::memory_order_relaxed);
+		reorder();
+	}
+
+	int size() const { return count; }
+
+	// snapshot of the order, read once per evaluation
+	uint64_t load() const
+	{
+		return order.load(boost::memory_order_relaxed);
+	}
+	// index of the i'th condition to evaluate
+	int at(uint64_t packed, int i) const
+	{
+		return count > MAX_CONDITIONS ? i : (int)((packed >> (i * 4)) & 15);
+	}
+
+	// counts are approximate, concurrent evaluations may lose an increment
+	void record(int condition, bool result)
+	{
+		if (condition >= MAX_CONDITIONS)
+			return;
+		tried[condition].store(tried[condition].load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+		if (result)
+			passed[condition].store(passed[condition].load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+	}
+
+	// called once per evaluation of the whole list
+	void evaluated()
+	{
+		const uint32_t n = evaluations.load(boost::memory_order_relaxed) + 1;
+		evaluations.store(n, boost::memory_order_relaxed);
+		if (n % REORDER_INTERVAL == 0)
+			reorder();
+	}
+
+private:
+	ConditionOrder(const ConditionOrder&);
+	ConditionOrder& operator=(const ConditionOrder&);
+
+	// expected cost of reaching a rejection through this condition, lower runs first
+	float score(int condition) const
+	{
+		// laplace smoothed so unseen conditions count as passing half the time
+		const float passRate = (passed[condition].load(boost::memory_order_relaxed) + 1.0f) / (tried[condition].load(boost::memory_order_relaxed) + 2.0f);
+		const float failRate = 1.0f - passRate;
+		return costs[condition] / (failRate < 0.001f ? 0.001f : failRate);
+	}
+
+	void reorder()
+	{
+		if (count > MAX_CONDITIONS)
+			return;
+
+		// halve old counts so the order follows changes in the game
+		for (int i = 0; i < count; ++i)
+		{
+			if (tried[i].load(boost::memory_order_relaxed) > DECAY_THRESHOLD)
+			{
+				tried[i].store(tried[i].load(boost::memory_order_relaxed) / 2, boost::memory_order_relaxed);
+				passed[i].store(passed[i].load(boost::memory_order_relaxed) / 2, boost::memory_order_relaxed);
+			}
+		}
+
+		int indices[MAX_CONDITIONS];
+		float scores[MAX_CONDITIONS];
+		// insertion sort, stable so ties keep authoring order
+		for (int i = 0; i < count; ++i)
+		{
+			const float s = score(i);
+			int j = i;
+			for (; j > 0 && scores[j - 1] > s; --j)
+			{
+				indices[j] = indices[j - 1];
+				scores[j] = scores[j - 1];
+			}
+			indices[j] = i;
+			scores[j] = s;
+		}
+
+		uint64_t packed = 0;
+		for (int i = 0; i < count; ++i)
+			packed |= (uint64_t)indices[i] << (i * 4);
+		order.store(packed, boost::memory_order_relaxed);
+	}
+
+	int count;
+	float costs[MAX_CONDITIONS];
+	boost::atomic<uint32_t> tried[MAX_CONDITIONS];
+	boost::atomic<uint32_t> passed[MAX_CONDITIONS];
+	boost::atomic<uint64_t> order;
+	boost::atomic<uint32_t> evaluations;
+};
@@ -0,0 +1,71 @@
+#include "ConditionRegistry.h"
+
+#include <string>
+#include <Debug.h>
+
+ConditionType conditionTypes[MAX_EXTENDED_CONDITIONS];
+
+// backing storage for ConditionType::name
+static std::string conditionNames[MAX_EXTENDED_CONDITIONS];
+
+static bool addCondition(int key, const char* name, ConditionHookEnum hook, float cost, const ConditionEvaluator* evaluators, ConditionValueReader read)
+{
+	const unsigned int index = (unsigned int)(key - EXTENDED_CONDITION_BASE);
+	if (index >= (unsigned int)MAX_EXTENDED_CONDITIONS)
+	{
+		ErrorLog("Conditions: key out of range for " + std::string(name));
+		return false;
+	}
+	if (conditionTypes[index].name)
+	{
+		ErrorLog("Conditions: " + std::string(name) + " uses the same key as " + conditionTypes[index].name);
+		return false;
+	}
+
+	ConditionType& type = conditionTypes[index];
+	conditionNames[index] = name;
+	type.hook = hook;
+	type.cost = cost;
+	type.read = read;
+	for (int i = 0; i < COMPARISON_COUNT; ++i)
+	{
+		type.evaluators[i] = evaluators[i];
+		type.squadEvaluators[i] = nullptr;
+	}
+	// set last, it marks the key as registered
+	type.name = conditionNames[index].c_str();
+	return true;
+}
+
+bool registerCondition(int key, const char* name, ConditionHookEnum hook, float cost, const ConditionEvaluator* evaluators)
+{
+	return addCondition(key, name, hook, cost, evaluators, nullptr);
+}
+
+bool registerSquadEvaluators(int key, const SquadConditionEvaluator* evaluators)
+{
+	ConditionType* type = const_cast<ConditionType*>(getConditionType(key));
+	if (!type)
+		return false;
+	for (int i = 0; i < COMPARISON_COUNT; ++i)
+		type->squadEvaluators[i] = evaluators[i];
+	return true;
+}
+
+static const ConditionEvaluator readerEvaluators[COMPARISON_COUNT] = {
+	&evaluateReader<0>,
+	&evaluateReader<1>,
+	&evaluateReader<2>
+};
+
+bool registerCondition(int key, const char* name, ConditionHookEnum hook, float cost, ConditionValueReader read)
+{
+	return addCondition(key, name, hook, cost, readerEvaluators, read);
+}
+
+extern "C" __declspec(dllexport) bool BFrizzExtraExtensions_registerCondition(int key, const char* name, int hook, float cost, ConditionValueReader read)
+{
+	if (!name || !read || (hook != CONDITION_HOOK_CHECK_CONDITIONS && hook != CONDITION_HOOK_CHECK_TAGS))
+		return false;
+	return addCondition(key, name, (ConditionHookEnum)hook, cost, readerEvaluators, read);
+}
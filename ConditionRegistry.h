@@ -0,0 +1,140 @@
+#pragma once
+
+#include <kenshi/Dialogue.h>
+#include <kenshi/Character.h>
+
+class ActivePlatoon;
+class Character;
+
+// conditions added by this plugin, other plugins can register their own keys with registerCondition
+enum ExtendedDialogConditionEnum
+{
+	DC_IS_SLEEPING = 1000,
+	DC_HAS_SHORT_TERM_TAG,
+	DC_IS_ALLY_BECAUSE_OF_DISGUISE,
+	DC_STAT_LEVEL_UNMODIFIED,
+	DC_STAT_LEVEL_MODIFIED,
+	DC_WEAPON_LEVEL,
+	DC_ARMOUR_LEVEL
+};
+
+// extended condition keys are EXTENDED_CONDITION_BASE + [0, MAX_EXTENDED_CONDITIONS), vanilla keys are below
+static const int EXTENDED_CONDITION_BASE = 1000;
+static const int MAX_EXTENDED_CONDITIONS = 256;
+
+// which hook evaluates a condition
+// checkConditions gets the line's DialogCondition, checkTags conditions are compiled from the line's GameData
+enum ConditionHookEnum
+{
+	CONDITION_HOOK_CHECK_CONDITIONS,
+	CONDITION_HOOK_CHECK_TAGS
+};
+
+// CE_EQUALS, CE_LESS_THAN, CE_MORE_THAN
+static const int COMPARISON_COUNT = 3;
+
+struct ConditionType;
+
+// check is the character the condition is about, whole squad conditions call this for each squad member
+typedef bool (*ConditionEvaluator)(const ConditionType& type, Character* check, Character* target, int tag, int value);
+// value compared against the condition's value
+typedef int (*ConditionValueReader)(Character* check, Character* target, int tag);
+// whole squad check in one call, true if any member of getSquadMembers(platoon, position) passes
+typedef bool (*SquadConditionEvaluator)(const ConditionType& type, ActivePlatoon* platoon, const Ogre::Vector3& position, Character* target, int tag, int value);
+
+struct ConditionType
+{
+	// nullptr if the key isn't registered
+	const char* name;
+	ConditionHookEnum hook;
+	// relative cost for ConditionOrder, 1 is about a field read
+	float cost;
+	// set for conditions registered with a runtime reader
+	ConditionValueReader read;
+	// by comparisonIndex
+	ConditionEvaluator evaluators[COMPARISON_COUNT];
+	// by comparisonIndex, nullptr to evaluate squad members one by one
+	SquadConditionEvaluator squadEvaluators[COMPARISON_COUNT];
+};
+
+// flat dispatch table indexed by key - EXTENDED_CONDITION_BASE
+extern ConditionType conditionTypes[MAX_EXTENDED_CONDITIONS];
+
+// nullptr for vanilla and unregistered keys
+inline const ConditionType* getConditionType(int key)
+{
+	const unsigned int index = (unsigned int)(key - EXTENDED_CONDITION_BASE);
+	if (index >= (unsigned int)MAX_EXTENDED_CONDITIONS || !conditionTypes[index].name)
+		return nullptr;
+	return &conditionTypes[index];
+}
+
+// index into ConditionType::evaluators, -1 for an unknown comparison
+inline int comparisonIndex(ComparisonEnum compareBy)
+{
+	switch (compareBy)
+	{
+		case ComparisonEnum::CE_EQUALS:
+			return 0;
+		case ComparisonEnum::CE_LESS_THAN:
+			return 1;
+		case ComparisonEnum::CE_MORE_THAN:
+			return 2;
+	}
+	return -1;
+}
+
+template<int Comparison>
+inline bool compareValues(int value, int conditionValue);
+
+template<>
+inline bool compareValues<0>(int value, int conditionValue) { return value == conditionValue; }
+template<>
+inline bool compareValues<1>(int value, int conditionValue) { return value < conditionValue; }
+template<>
+inline bool compareValues<2>(int value, int conditionValue) { return value > conditionValue; }
+
+// evaluator for a reader known at compile time, the read is inlined into each comparison
+template<int (*Read)(Character*, Character*, int), int Comparison>
+bool evaluateStatic(const ConditionType&, Character* check, Character* target, int tag, int value)
+{
+	return compareValues<Comparison>(Read(check, target, tag), value);
+}
+
+// evaluator for a reader registered at runtime
+template<int Comparison>
+bool evaluateReader(const ConditionType& type, Character* check, Character* target, int tag, int value)
+{
+	return compareValues<Comparison>(type.read(check, target, tag), value);
+}
+
+// unknown comparisons never pass
+inline bool evaluateCondition(const ConditionType& type, ComparisonEnum compareBy, Character* check, Character* target, int tag, int value)
+{
+	const int comparison = comparisonIndex(compareBy);
+	return comparison >= 0 && type.evaluators[comparison](type, check, target, tag, value);
+}
+
+// Registration must happen before any dialogue is evaluated, ie from startPlugin. Returns false if the key is out of
+// range or already registered.
+// evaluators are by comparisonIndex
+bool registerCondition(int key, const char* name, ConditionHookEnum hook, float cost, const ConditionEvaluator* evaluators);
+bool registerCondition(int key, const char* name, ConditionHookEnum hook, float cost, ConditionValueReader read);
+
+// adds a whole squad fast path to a registered key, evaluators are by comparisonIndex
+bool registerSquadEvaluators(int key, const SquadConditionEvaluator* evaluators);
+
+template<int (*Read)(Character*, Character*, int)>
+bool registerStaticCondition(int key, const char* name, ConditionHookEnum hook, float cost)
+{
+	const ConditionEvaluator evaluators[COMPARISON_COUNT] = {
+		&evaluateStatic<Read, 0>,
+		&evaluateStatic<Read, 1>,
+		&evaluateStatic<Read, 2>
+	};
+	return registerCondition(key, name, hook, cost, evaluators);
+}
+
+// for other plugins, hook is a ConditionHookEnum
+// read is only called from the thread evaluating the dialogue
+extern "C" __declspec(dllexport) bool BFrizzExtraExtensions_registerCondition(int key, const char* name, int hook, float cost, ConditionValueReader read);
@@ -0,0 +1,210 @@
+#include "Diagnostics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <Debug.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+namespace
+{
+	// sites are all constructed while the DLL loads, before any thread can report
+	const uint32_t MAX_SITES = 256;
+	DiagnosticSite* sites[MAX_SITES];
+	uint32_t siteCount;
+
+	// power of two
+	const uint32_t RING_SIZE = 256;
+	const size_t DETAIL_LENGTH = 120;
+
+	struct Record
+	{
+		// RING_SIZE apart between laps, the slot is readable when it's one past the record's position
+		boost::atomic<uint32_t> sequence;
+		uint32_t site;
+		uint32_t occurrence;
+		char detail[DETAIL_LENGTH];
+	};
+
+	// bounded multi producer, single consumer queue
+	struct Ring
+	{
+		Record records[RING_SIZE];
+		boost::atomic<uint32_t> tail;
+		// only touched by the writer
+		uint32_t head;
+
+		Ring()
+			: tail(0), head(0)
+		{
+			for (uint32_t i = 0; i < RING_SIZE; ++i)
+				records[i].sequence.store(i, boost::memory_order_relaxed);
+		}
+
+		bool push(uint32_t site, uint32_t occurrence, const char* detail)
+		{
+			uint32_t position = tail.load(boost::memory_order_relaxed);
+			Record* record;
+			while (true)
+			{
+				record = &records[position & (RING_SIZE - 1)];
+				const int32_t diff = (int32_t)(record->sequence.load(boost::memory_order_acquire) - position);
+				if (diff == 0)
+				{
+					if (tail.compare_exchange_weak(position, position + 1, boost::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					// full, the writer hasn't caught up
+					return false;
+				}
+				else
+				{
+					position = tail.load(boost::memory_order_relaxed);
+				}
+			}
+
+			record->site = site;
+			record->occurrence = occurrence;
+			const size_t length = detail ? std::min(strlen(detail), DETAIL_LENGTH - 1) : 0;
+			if (length)
+				memcpy(record->detail, detail, length);
+			record->detail[length] = '\0';
+			record->sequence.store(position + 1, boost::memory_order_release);
+			return true;
+		}
+
+		bool pop(uint32_t& site, uint32_t& occurrence, std::string& detail)
+		{
+			Record& record = records[head & (RING_SIZE - 1)];
+			if (record.sequence.load(boost::memory_order_acquire) != head + 1)
+				return false;
+
+			site = record.site;
+			occurrence = record.occurrence;
+			detail = record.detail;
+			record.sequence.store(head + RING_SIZE, boost::memory_order_release);
+			++head;
+			return true;
+		}
+	};
+
+	Ring ring;
+}
+
+DiagnosticSite::DiagnosticSite(const char* message)
+	: message(message), id(siteCount), occurrences(0), unreported(0)
+{
+	if (siteCount < MAX_SITES)
+		sites[siteCount++] = this;
+}
+
+void reportDiagnostic(DiagnosticSite& site, const char* detail)
+{
+	const uint32_t occurrence = site.occurrences.fetch_add(1, boost::memory_order_relaxed) + 1;
+	if (occurrence > FULL_REPORTS || site.id >= MAX_SITES || !ring.push(site.id, occurrence, detail))
+		site.unreported.fetch_add(1, boost::memory_order_relaxed);
+}
+
+class DiagnosticWriter
+{
+public:
+	DiagnosticWriter()
+		: thread(nullptr), stopping(false)
+	{
+	}
+
+	~DiagnosticWriter()
+	{
+		if (thread)
+		{
+			stopping.store(true, boost::memory_order_relaxed);
+			thread->join();
+			delete thread;
+		}
+	}
+
+	void start()
+	{
+		if (!thread)
+			thread = new boost::thread(&DiagnosticWriter::run, this);
+	}
+
+	void flush()
+	{
+		boost::lock_guard<boost::mutex> guard(writeLock);
+		drain();
+		summarise();
+	}
+
+private:
+	void run()
+	{
+		int ticks = 0;
+		while (!stopping.load(boost::memory_order_relaxed))
+		{
+			boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+			boost::lock_guard<boost::mutex> guard(writeLock);
+			drain();
+			if (++ticks >= SUMMARY_INTERVAL * 10)
+			{
+				summarise();
+				ticks = 0;
+			}
+		}
+		flush();
+	}
+
+	// writeLock must be held
+	void drain()
+	{
+		uint32_t site;
+		uint32_t occurrence;
+		std::string detail;
+		while (ring.pop(site, occurrence, detail))
+		{
+			std::string message = sites[site]->getMessage() + detail;
+			if (occurrence == FULL_REPORTS)
+				message += " (further occurrences are summarised)";
+			ErrorLog(message);
+		}
+	}
+
+	// writeLock must be held
+	void summarise()
+	{
+		for (uint32_t i = 0; i < siteCount; ++i)
+		{
+			const uint32_t count = sites[i]->unreported.exchange(0, boost::memory_order_relaxed);
+			if (count == 0)
+				continue;
+			// without the separator details were appended after
+			std::string message = sites[i]->getMessage();
+			while (!message.empty() && (message[message.size() - 1] == ' ' || message[message.size() - 1] == ':'))
+				message.erase(message.size() - 1);
+			ErrorLog(message + " x" + boost::lexical_cast<std::string>(count)
+				+ " (" + boost::lexical_cast<std::string>(sites[i]->occurrences.load(boost::memory_order_relaxed)) + " total)");
+		}
+	}
+
+	boost::thread* thread;
+	boost::atomic<bool> stopping;
+	boost::mutex writeLock;
+};
+
+static DiagnosticWriter writer;
+
+void startDiagnostics()
+{
+	writer.start();
+}
+
+void flushDiagnostics()
+{
+	writer.flush();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <boost/atomic.hpp>
+
+// Error reporting for the hooks
+// Each place that reports an error owns a DiagnosticSite, defined at namespace scope so it's interned while the DLL
+// loads. The first FULL_REPORTS occurrences of a site are logged in full, later ones are only counted and logged as a
+// summary every SUMMARY_INTERVAL seconds. Reporting never formats or writes anything on the calling thread, records go
+// through a lock-free ring buffer to a background writer. If the ring is full the occurrence is summarised instead.
+class DiagnosticSite
+{
+public:
+	// message must be a string literal, details are appended to it
+	explicit DiagnosticSite(const char* message);
+
+	const char* getMessage() const { return message; }
+	uint32_t getId() const { return id; }
+
+private:
+	friend void reportDiagnostic(DiagnosticSite& site, const char* detail);
+	friend class DiagnosticWriter;
+
+	DiagnosticSite(const DiagnosticSite&);
+	DiagnosticSite& operator=(const DiagnosticSite&);
+
+	const char* message;
+	uint32_t id;
+	boost::atomic<uint32_t> occurrences;
+	// occurrences not logged in full since the last summary
+	boost::atomic<uint32_t> unreported;
+};
+
+static const uint32_t FULL_REPORTS = 10;
+static const int SUMMARY_INTERVAL = 10;
+
+// detail is copied, long details are truncated
+void reportDiagnostic(DiagnosticSite& site, const char* detail = nullptr);
+
+// starts the background writer, reports made before this are written once it starts
+void startDiagnostics();
+// writes everything queued and any pending summaries now, for shutdown and tools
+void flushDiagnostics();
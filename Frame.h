@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <boost/atomic.hpp>
+
+// incremented at the start of every game frame, per-frame caches are keyed on this
+extern boost::atomic<uint32_t> currentFrame;
+
+inline uint32_t getFrame()
+{
+	return currentFrame.load(boost::memory_order_relaxed);
+}
@@ -0,0 +1,139 @@
+#include "GearSummary.h"
+#include "Frame.h"
+#include "ScratchLektor.h"
+
+#include <algorithm>
+#include <kenshi/Character.h>
+#include <kenshi/Gear.h>
+#include <kenshi/Inventory.h>
+#include <boost/thread/tss.hpp>
+
+namespace
+{
+	boost::atomic<uint32_t> gearEpoch(0);
+
+	// flat open addressing table, entries are reused between frames so their vectors keep their allocations
+	struct GearCache
+	{
+		uint32_t frame;
+		uint32_t epoch;
+
+		std::vector<Character*> characters;
+		std::vector<GearSummary> summaries;
+		size_t used;
+		// indexes characters/summaries, -1 if empty, at most half full
+		std::vector<int> index;
+
+		GearCache() : frame(0), epoch(0), used(0), index(64, -1) {}
+
+		void clear()
+		{
+			used = 0;
+			std::fill(index.begin(), index.end(), -1);
+		}
+
+		size_t slotFor(Character* character) const
+		{
+			const size_t mask = index.size() - 1;
+			size_t i = (((uintptr_t)character >> 4) * 2654435761u) & mask;
+			while (index[i] != -1 && characters[index[i]] != character)
+				i = (i + 1) & mask;
+			return i;
+		}
+
+		void grow()
+		{
+			index.assign(index.size() * 2, -1);
+			for (size_t i = 0; i < used; ++i)
+				index[slotFor(characters[i])] = (int)i;
+		}
+	};
+
+	boost::thread_specific_ptr<GearCache> gearCache;
+
+	void buildSummary(Character* character, GearSummary& summary)
+	{
+		// Note: this check often doesn't check equipped weapons on back
+		Weapon* weapon = character->getCurrentWeapon();
+		// this seems to be the same
+		if (!weapon)
+			weapon = character->getThePreferredWeapon();
+		summary.carriedWeaponLevel = weapon == nullptr ? -1 : weapon->getLevel();
+
+		// the slots are only scanned when there's nothing carried, as that's all DC_WEAPON_LEVEL needs
+		summary.maxWeaponLevel = -1;
+		if (!weapon)
+		{
+			ScratchLektor<InventorySection*> sections;
+			character->inventory->getAllSectionsOfType(sections, AttachSlot::ATTACH_WEAPON);
+			for (int i = 0; i < sections.size(); ++i)
+			{
+				const Ogre::vector<InventorySection::SectionItem>::type& items = sections[i]->getItems();
+				for (size_t j = 0; j < items.size(); ++j)
+				{
+					Weapon* slotWeapon = dynamic_cast<Weapon*>(items[j].item);
+					if (slotWeapon)
+						summary.maxWeaponLevel = std::max(summary.maxWeaponLevel, slotWeapon->getLevel());
+				}
+			}
+		}
+
+		ScratchLektor<Item*> armour;
+		character->getInventory()->getEquippedArmour(armour);
+
+		summary.armourLevels.clear();
+		for (int i = 0; i < armour.size(); ++i)
+			summary.armourLevels.push_back(armour[i]->getLevel());
+		std::sort(summary.armourLevels.begin(), summary.armourLevels.end());
+		summary.armourLevels.erase(std::unique(summary.armourLevels.begin(), summary.armourLevels.end()), summary.armourLevels.end());
+		summary.minArmourLevel = summary.armourLevels.empty() ? -1 : summary.armourLevels.front();
+		summary.maxArmourLevel = summary.armourLevels.empty() ? -1 : summary.armourLevels.back();
+	}
+}
+
+const GearSummary& getGearSummary(Character* character)
+{
+	GearCache* cache = gearCache.get();
+	if (!cache)
+	{
+		cache = new GearCache();
+		gearCache.reset(cache);
+	}
+
+	// only summaries from this frame are kept, so the cache is bounded by the characters checked in one frame
+	const uint32_t frame = getFrame();
+	const uint32_t epoch = gearEpoch.load(boost::memory_order_acquire);
+	if (cache->frame != frame || cache->epoch != epoch)
+	{
+		cache->clear();
+		cache->frame = frame;
+		cache->epoch = epoch;
+	}
+
+	size_t slot = cache->slotFor(character);
+	if (cache->index[slot] != -1)
+		return cache->summaries[cache->index[slot]];
+
+	if ((cache->used + 1) * 2 > cache->index.size())
+	{
+		cache->grow();
+		slot = cache->slotFor(character);
+	}
+
+	if (cache->used == cache->characters.size())
+	{
+		cache->characters.push_back(nullptr);
+		cache->summaries.push_back(GearSummary());
+	}
+
+	const size_t entry = cache->used++;
+	cache->characters[entry] = character;
+	cache->index[slot] = (int)entry;
+	buildSummary(character, cache->summaries[entry]);
+	return cache->summaries[entry];
+}
+
+void invalidateGearSummaries()
+{
+	gearEpoch.fetch_add(1, boost::memory_order_release);
+}
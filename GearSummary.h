@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+class Character;
+
+// Weapon and armour levels read by DC_WEAPON_LEVEL and DC_ARMOUR_LEVEL
+struct GearSummary
+{
+	// current or preferred weapon, -1 if there isn't one
+	int carriedWeaponLevel;
+	// highest level weapon in the weapon slots, -1 if unarmed
+	int maxWeaponLevel;
+
+	// levels of equipped armour, sorted and unique, empty if unarmoured
+	std::vector<int> armourLevels;
+	int minArmourLevel;
+	int maxArmourLevel;
+
+	// level DC_WEAPON_LEVEL compares against
+	int weaponLevel() const { return carriedWeaponLevel != -1 ? carriedWeaponLevel : maxWeaponLevel; }
+};
+
+// Summaries are built once per character and reused until the next frame or until invalidateGearSummaries is
+// called, so whole squad checks on many lines don't rescan inventories. Cached per thread, the reference is valid
+// until the next call.
+const GearSummary& getGearSummary(Character* character);
+
+// call after changing a character's inventory
+void invalidateGearSummaries();
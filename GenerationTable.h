@@ -0,0 +1,232 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+// Pointer -> pointer map with lock-free reads
+// Writers are serialised by a mutex, readers never block. Slots are never emptied, so lookups are a linear probe
+// over a flat array with a seqlock per slot to catch concurrent overwrites.
+// Every entry is tagged with the last generation it was inserted or found in. nextGeneration() is called when
+// the game reloads, and entries that haven't been touched in the current or previous generation can then be
+// overwritten by new inserts. This keeps memory bounded over long sessions with repeated loads.
+// Inserting a key that already exists replaces its value, so a new object allocated at the address of a dead
+// one never sees the old value.
+template<typename Key, typename Value>
+class GenerationTable
+{
+public:
+	GenerationTable(uint32_t initialCapacity = 256)
+		: generation(0), used(0)
+	{
+		uint32_t capacity = 16;
+		while (capacity < initialCapacity)
+			capacity <<= 1;
+		table.store(new Table(capacity), boost::memory_order_release);
+	}
+
+	~GenerationTable()
+	{
+		delete table.load(boost::memory_order_acquire);
+		for (size_t i = 0; i < retired.size(); ++i)
+			delete retired[i].table;
+	}
+
+	// lock-free, returns nullptr if the key isn't in the table
+	Value* find(Key* key) const
+	{
+		const Table* current = table.load(boost::memory_order_acquire);
+		const uint32_t currentGeneration = generation.load(boost::memory_order_relaxed);
+
+		uint32_t i = hash(key) & current->mask;
+		while (true)
+		{
+			Slot& slot = current->slots[i];
+
+			const uint32_t seq = slot.sequence.load(boost::memory_order_acquire);
+			if (seq & 1)
+				continue; // being written, retry the same slot
+			Key* slotKey = slot.key.load(boost::memory_order_relaxed);
+			Value* slotValue = slot.value.load(boost::memory_order_relaxed);
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			if (slot.sequence.load(boost::memory_order_relaxed) != seq)
+				continue;
+
+			// end of probe chain
+			if (slotKey == nullptr)
+				return nullptr;
+
+			if (slotKey == key)
+			{
+				// keep the entry alive, this is the only write on the read path and is only done once per generation
+				if (slot.generation.load(boost::memory_order_relaxed) != currentGeneration)
+					slot.generation.store(currentGeneration, boost::memory_order_relaxed);
+				return slotValue;
+			}
+
+			i = (i + 1) & current->mask;
+		}
+	}
+
+	// replaces any existing entry for key
+	void insert(Key* key, Value* value)
+	{
+		boost::lock_guard<boost::mutex> lock(writeLock);
+
+		Table* current = table.load(boost::memory_order_relaxed);
+		const uint32_t currentGeneration = generation.load(boost::memory_order_relaxed);
+
+		Slot* reusable = nullptr;
+		uint32_t i = hash(key) & current->mask;
+		while (true)
+		{
+			Slot& slot = current->slots[i];
+			Key* slotKey = slot.key.load(boost::memory_order_relaxed);
+
+			if (slotKey == key)
+			{
+				write(slot, key, value, currentGeneration);
+				return;
+			}
+
+			if (slotKey == nullptr)
+				break;
+
+			if (!reusable && isStale(slot, currentGeneration))
+				reusable = &slot;
+
+			i = (i + 1) & current->mask;
+		}
+
+		if (reusable)
+		{
+			write(*reusable, key, value, currentGeneration);
+			return;
+		}
+
+		write(current->slots[i], key, value, currentGeneration);
+		++used;
+
+		// keep probe chains short, stale entries are dropped when rebuilding
+		if (used * 2 > current->mask + 1)
+			rebuild(current, currentGeneration);
+	}
+
+	// called when the game reloads
+	void nextGeneration()
+	{
+		boost::lock_guard<boost::mutex> lock(writeLock);
+
+		const uint32_t currentGeneration = generation.load(boost::memory_order_relaxed) + 1;
+		generation.store(currentGeneration, boost::memory_order_relaxed);
+
+		// tables replaced during the generation before last can't still have readers
+		size_t kept = 0;
+		for (size_t i = 0; i < retired.size(); ++i)
+		{
+			if (retired[i].generation + 1 < currentGeneration)
+				delete retired[i].table;
+			else
+				retired[kept++] = retired[i];
+		}
+		retired.resize(kept);
+	}
+
+private:
+	struct Slot
+	{
+		// odd while the slot is being written
+		boost::atomic<uint32_t> sequence;
+		boost::atomic<Key*> key;
+		boost::atomic<Value*> value;
+		// last generation the entry was inserted or found in
+		boost::atomic<uint32_t> generation;
+
+		Slot() : sequence(0), key(nullptr), value(nullptr), generation(0) {}
+	};
+
+	struct Table
+	{
+		uint32_t mask;
+		Slot* slots;
+
+		Table(uint32_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) {}
+		~Table() { delete[] slots; }
+	};
+
+	struct RetiredTable
+	{
+		Table* table;
+		uint32_t generation;
+	};
+
+	static uint32_t hash(Key* key)
+	{
+		// fibonacci hashing, low bits of heap pointers are always 0
+		return (uint32_t)(((uintptr_t)key >> 4) * 2654435761u);
+	}
+
+	static bool isStale(const Slot& slot, uint32_t currentGeneration)
+	{
+		return slot.generation.load(boost::memory_order_relaxed) + 1 < currentGeneration;
+	}
+
+	static void write(Slot& slot, Key* key, Value* value, uint32_t currentGeneration)
+	{
+		const uint32_t seq = slot.sequence.load(boost::memory_order_relaxed);
+		slot.sequence.store(seq + 1, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_release);
+		slot.key.store(key, boost::memory_order_relaxed);
+		slot.value.store(value, boost::memory_order_relaxed);
+		slot.generation.store(currentGeneration, boost::memory_order_relaxed);
+		slot.sequence.store(seq + 2, boost::memory_order_release);
+	}
+
+	// writeLock must be held
+	void rebuild(Table* current, uint32_t currentGeneration)
+	{
+		uint32_t live = 0;
+		for (uint32_t i = 0; i <= current->mask; ++i)
+			if (current->slots[i].key.load(boost::memory_order_relaxed) && !isStale(current->slots[i], currentGeneration))
+				++live;
+
+		// size for at most 25% load after the rebuild
+		uint32_t capacity = 16;
+		while (capacity < live * 4)
+			capacity <<= 1;
+
+		Table* replacement = new Table(capacity);
+		used = 0;
+		for (uint32_t i = 0; i <= current->mask; ++i)
+		{
+			Slot& slot = current->slots[i];
+			Key* key = slot.key.load(boost::memory_order_relaxed);
+			if (!key || isStale(slot, currentGeneration))
+				continue;
+
+			uint32_t j = hash(key) & replacement->mask;
+			while (replacement->slots[j].key.load(boost::memory_order_relaxed) != nullptr)
+				j = (j + 1) & replacement->mask;
+			write(replacement->slots[j], key, slot.value.load(boost::memory_order_relaxed), slot.generation.load(boost::memory_order_relaxed));
+			++used;
+		}
+
+		table.store(replacement, boost::memory_order_release);
+
+		// readers may still be probing the old table
+		RetiredTable old;
+		old.table = current;
+		old.generation = currentGeneration;
+		retired.push_back(old);
+	}
+
+	boost::atomic<Table*> table;
+	boost::atomic<uint32_t> generation;
+
+	boost::mutex writeLock;
+	// slots holding a key, live or stale
+	uint32_t used;
+	std::vector<RetiredTable> retired;
+};
@@ -0,0 +1,330 @@
+#include "HookStats.h"
+#include "Frame.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <Debug.h>
+#include <kenshi/GameData.h>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+bool hookStatsEnabled = false;
+
+static const char* hookNames[HOOK_COUNT] = {
+	"getFromData",
+	"isTrue",
+	"checkConditions",
+	"checkTags",
+	"_doActions",
+	"saveGameState",
+	"loadAllPlatoons"
+};
+
+// bucket i counts calls that took [2^i, 2^(i+1)) ns
+static const int HISTOGRAM_BUCKETS = 32;
+// thread samples are merged into the totals after this many
+static const uint32_t FLUSH_SAMPLES = 4096;
+
+struct HookCounters
+{
+	uint64_t calls;
+	// calls with a result
+	uint64_t results;
+	uint64_t passed;
+	uint64_t ticks;
+	uint64_t histogram[HISTOGRAM_BUCKETS];
+};
+
+struct LineCounters
+{
+	uint64_t evaluations;
+	uint64_t passed;
+	uint64_t failed;
+	uint64_t ticks;
+	uint64_t squadScans;
+	uint64_t squadTicks;
+};
+
+// by line and hook
+typedef boost::unordered_map<std::pair<GameData*, int>, LineCounters> LineCounterMap;
+
+struct Counters
+{
+	HookCounters hooks[HOOK_COUNT];
+	LineCounterMap lines;
+
+	Counters()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		memset(hooks, 0, sizeof(hooks));
+		lines.clear();
+	}
+
+	void mergeInto(Counters& total) const
+	{
+		for (int h = 0; h < HOOK_COUNT; ++h)
+		{
+			total.hooks[h].calls += hooks[h].calls;
+			total.hooks[h].results += hooks[h].results;
+			total.hooks[h].passed += hooks[h].passed;
+			total.hooks[h].ticks += hooks[h].ticks;
+			for (int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+				total.hooks[h].histogram[b] += hooks[h].histogram[b];
+		}
+		for (LineCounterMap::const_iterator iter = lines.begin(); iter != lines.end(); ++iter)
+		{
+			LineCounters& line = total.lines[iter->first];
+			line.evaluations += iter->second.evaluations;
+			line.passed += iter->second.passed;
+			line.failed += iter->second.failed;
+			line.ticks += iter->second.ticks;
+			line.squadScans += iter->second.squadScans;
+			line.squadTicks += iter->second.squadTicks;
+		}
+	}
+};
+
+static boost::mutex totalsLock;
+static Counters totals;
+
+static void mergeIntoTotals(Counters& counters)
+{
+	boost::lock_guard<boost::mutex> lock(totalsLock);
+	counters.mergeInto(totals);
+	counters.clear();
+}
+
+struct ThreadCounters
+{
+	Counters counters;
+	uint32_t samples;
+	// frame of the last merge
+	uint32_t frame;
+
+	ThreadCounters()
+		: samples(0), frame(getFrame())
+	{
+	}
+
+	// samples from threads that exit aren't lost
+	~ThreadCounters()
+	{
+		mergeIntoTotals(counters);
+	}
+};
+
+static boost::thread_specific_ptr<ThreadCounters> threadCounters;
+
+static std::string dumpPath;
+static float dumpInterval = 0;
+static float sinceDump = 0;
+
+static double readNsPerTick()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return 1e9 / (double)frequency.QuadPart;
+#else
+	return 1;
+#endif
+}
+
+static const double nsPerTick = readNsPerTick();
+
+uint64_t readHookTicks()
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)counter.QuadPart;
+#else
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+uint64_t hookTicksToNs(uint64_t ticks)
+{
+	return (uint64_t)(ticks * nsPerTick);
+}
+
+void enableHookStats(const char* path, float interval)
+{
+	dumpPath = path;
+	dumpInterval = interval;
+	hookStatsEnabled = true;
+	DebugLog("Hook stats: writing to " + dumpPath);
+}
+
+static int histogramBucket(uint64_t ticks)
+{
+	uint64_t ns = (uint64_t)(ticks * nsPerTick);
+	int bucket = 0;
+	while (ns > 1 && bucket < HISTOGRAM_BUCKETS - 1)
+	{
+		ns >>= 1;
+		++bucket;
+	}
+	return bucket;
+}
+
+void HookScope::record()
+{
+	const uint64_t ticks = readHookTicks() - start;
+
+	ThreadCounters* local = threadCounters.get();
+	if (!local)
+	{
+		local = new ThreadCounters();
+		threadCounters.reset(local);
+	}
+
+	HookCounters& counters = local->counters.hooks[hook];
+	++counters.calls;
+	counters.results += passed >= 0;
+	counters.passed += passed == 1;
+	counters.ticks += ticks;
+	++counters.histogram[histogramBucket(ticks)];
+
+	if (line)
+	{
+		LineCounters& lineCounters = local->counters.lines[std::make_pair(line, (int)hook)];
+		++lineCounters.evaluations;
+		lineCounters.passed += passed == 1;
+		lineCounters.failed += passed == 0;
+		lineCounters.ticks += ticks;
+		lineCounters.squadScans += squadScans;
+		lineCounters.squadTicks += squadTicks;
+	}
+
+	if (++local->samples >= FLUSH_SAMPLES || local->frame != getFrame())
+	{
+		mergeIntoTotals(local->counters);
+		local->samples = 0;
+		local->frame = getFrame();
+	}
+}
+
+static void mergeThisThread()
+{
+	ThreadCounters* local = threadCounters.get();
+	if (local)
+	{
+		mergeIntoTotals(local->counters);
+		local->samples = 0;
+		local->frame = getFrame();
+	}
+}
+
+// upper bound of the bucket containing the fraction'th call
+static uint64_t percentileNs(const HookCounters& counters, double fraction)
+{
+	const uint64_t target = (uint64_t)(counters.calls * fraction);
+	uint64_t seen = 0;
+	for (int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+	{
+		seen += counters.histogram[b];
+		if (seen > target)
+			return 2ull << b;
+	}
+	return 2ull << (HISTOGRAM_BUCKETS - 1);
+}
+
+struct LineRow
+{
+	std::string stringID;
+	int hook;
+	LineCounters counters;
+};
+
+static bool compareLineRows(const LineRow& a, const LineRow& b)
+{
+	return a.counters.ticks > b.counters.ticks;
+}
+
+void dumpHookStats()
+{
+	mergeThisThread();
+
+	Counters snapshot;
+	{
+		boost::lock_guard<boost::mutex> lock(totalsLock);
+		totals.mergeInto(snapshot);
+	}
+
+	FILE* file = fopen(dumpPath.c_str(), "w");
+	if (!file)
+	{
+		ErrorLog("Hook stats: could not write " + dumpPath);
+		return;
+	}
+
+	// times include the engine function the hook calls
+	fprintf(file, "%-18s %12s %8s %12s %10s %10s %10s %10s\n", "hook", "calls", "true%", "total ms", "mean ns", "p50 ns", "p90 ns", "p99 ns");
+	for (int h = 0; h < HOOK_COUNT; ++h)
+	{
+		const HookCounters& counters = snapshot.hooks[h];
+		if (counters.calls == 0)
+			continue;
+		char passRate[16] = "-";
+		if (counters.results)
+			sprintf(passRate, "%.1f", 100.0 * counters.passed / counters.results);
+		fprintf(file, "%-18s %12llu %8s %12.2f %10.0f %10llu %10llu %10llu\n", hookNames[h], (unsigned long long)counters.calls,
+			passRate, counters.ticks * nsPerTick / 1e6, counters.ticks * nsPerTick / counters.calls,
+			(unsigned long long)percentileNs(counters, 0.5), (unsigned long long)percentileNs(counters, 0.9),
+			(unsigned long long)percentileNs(counters, 0.99));
+	}
+
+	// slowest lines first
+	std::vector<LineRow> rows;
+	rows.reserve(snapshot.lines.size());
+	for (LineCounterMap::const_iterator iter = snapshot.lines.begin(); iter != snapshot.lines.end(); ++iter)
+	{
+		LineRow row;
+		row.stringID = iter->first.first->stringID;
+		row.hook = iter->first.second;
+		row.counters = iter->second;
+		rows.push_back(row);
+	}
+	std::sort(rows.begin(), rows.end(), compareLineRows);
+
+	fprintf(file, "\n%-40s %-18s %12s %12s %12s %12s %12s %12s\n", "line", "hook", "evaluations", "passed", "failed", "total ms", "squad scans", "squad ms");
+	for (size_t i = 0; i < rows.size(); ++i)
+	{
+		const LineCounters& counters = rows[i].counters;
+		fprintf(file, "%-40s %-18s %12llu %12llu %12llu %12.2f %12llu %12.2f\n", rows[i].stringID.c_str(), hookNames[rows[i].hook],
+			(unsigned long long)counters.evaluations, (unsigned long long)counters.passed, (unsigned long long)counters.failed,
+			counters.ticks * nsPerTick / 1e6, (unsigned long long)counters.squadScans, counters.squadTicks * nsPerTick / 1e6);
+	}
+
+	fclose(file);
+}
+
+void updateHookStats(float frameTime)
+{
+	mergeThisThread();
+
+	sinceDump += frameTime;
+	if (sinceDump >= dumpInterval)
+	{
+		sinceDump = 0;
+		dumpHookStats();
+	}
+}
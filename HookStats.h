@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+class GameData;
+
+// hooks installed in startPlugin that are timed
+enum HookId
+{
+	HOOK_GET_FROM_DATA,
+	HOOK_IS_TRUE,
+	HOOK_CHECK_CONDITIONS,
+	HOOK_CHECK_TAGS,
+	HOOK_DO_ACTIONS,
+	HOOK_SAVE_GAME_STATE,
+	HOOK_LOAD_ALL_PLATOONS,
+	HOOK_COUNT
+};
+
+// Call counts and latency histograms per hook, broken down per dialogue line so slow mod lines can be found.
+// Off unless enableHookStats is called before the hooks are installed, a disabled scope costs a branch.
+// Samples are accumulated per thread and merged into the totals every few thousand samples or on a new frame,
+// the totals are written to a text file every few seconds.
+extern bool hookStatsEnabled;
+
+// interval is in seconds of game time
+void enableHookStats(const char* path, float dumpInterval);
+// merges this thread's samples and writes the file when the interval has passed, called once a frame
+void updateHookStats(float frameTime);
+// merges this thread's samples and writes the file now
+void dumpHookStats();
+
+uint64_t readHookTicks();
+uint64_t hookTicksToNs(uint64_t ticks);
+
+// times a hook call, line is the DialogLineData's GameData for per-line counters
+class HookScope
+{
+public:
+	HookScope(HookId hook, GameData* line = nullptr)
+		: hook(hook), line(line), passed(-1), start(0), squadTicks(0), squadScans(0)
+	{
+		if (hookStatsEnabled)
+			start = readHookTicks();
+	}
+	~HookScope()
+	{
+		if (hookStatsEnabled)
+			record();
+	}
+
+	// records the hook's result and passes it through
+	bool result(bool value)
+	{
+		passed = value ? 1 : 0;
+		return value;
+	}
+
+private:
+	friend class SquadScanScope;
+
+	HookScope(const HookScope&);
+	HookScope& operator=(const HookScope&);
+
+	void record();
+
+	HookId hook;
+	GameData* line;
+	// -1 if the hook has no result
+	int passed;
+	uint64_t start;
+	uint64_t squadTicks;
+	uint32_t squadScans;
+};
+
+// times a T_WHOLE_SQUAD scan within a hook
+class SquadScanScope
+{
+public:
+	SquadScanScope(HookScope& scope)
+		: scope(scope), start(0)
+	{
+		if (hookStatsEnabled)
+			start = readHookTicks();
+	}
+	~SquadScanScope()
+	{
+		if (hookStatsEnabled)
+		{
+			scope.squadTicks += readHookTicks() - start;
+			++scope.squadScans;
+		}
+	}
+
+private:
+	SquadScanScope(const SquadScanScope&);
+	SquadScanScope& operator=(const SquadScanScope&);
+
+	HookScope& scope;
+	uint64_t start;
+};
@@ -0,0 +1,148 @@
+#include "ItemTransfer.h"
+
+#include <algorithm>
+
+#include <kenshi/Character.h>
+#include <kenshi/Gear.h>
+#include <kenshi/Inventory.h>
+#include <kenshi/GameWorld.h>
+#include <kenshi/Globals.h>
+#include <kenshi/RootObjectFactory.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+namespace
+{
+	struct DestroyRequest
+	{
+		std::vector<Character*> owners;
+		GameData* itemData;
+		int count;
+	};
+
+	std::vector<DestroyRequest> destroyQueue;
+	boost::mutex destroyQueueLock;
+}
+
+int planItemStacks(Character* const* owners, size_t ownerCount, GameData* itemData, int count, std::vector<ItemStackPlan>& plan)
+{
+	int planned = 0;
+	for (size_t o = 0; o < ownerCount && planned < count; ++o)
+	{
+		Character* owner = owners[o];
+		if (owner == nullptr || owner->inventory == nullptr)
+			continue;
+
+		lektor<Item*>& items = owner->inventory->getAllItems();
+		for (int i = 0; i < items.size() && planned < count; ++i)
+		{
+			Item* item = items[i];
+			if (item == nullptr || item->data != itemData || item->quantity <= 0)
+				continue;
+
+			ItemStackPlan step;
+			step.owner = owner;
+			step.item = item;
+			// only the last stack can be partial
+			step.quantity = std::min(item->quantity, count - planned);
+			plan.push_back(step);
+			planned += step.quantity;
+		}
+	}
+	return planned;
+}
+
+int takeItems(Character* const* givers, size_t giverCount, Character* taker, GameData* itemData, int count)
+{
+	std::vector<ItemStackPlan> plan;
+	const int countTaken = planItemStacks(givers, giverCount, itemData, count, plan);
+
+	// inventories are only changed once the plan is complete, so nothing is invalidated while walking them
+	for (size_t i = 0; i < plan.size(); ++i)
+	{
+		Item* item = plan[i].item;
+		if (plan[i].quantity < item->quantity)
+		{
+			// part of stack is moved, split by creating new instance
+			item->quantity -= plan[i].quantity;
+			Item* newItem = ou->theFactory->copyItem(item);
+			newItem->quantity = plan[i].quantity;
+			taker->giveItem(newItem, true, false);
+		}
+		else
+		{
+			// whole stack is moved
+			plan[i].owner->dropItem(item);
+			taker->giveItem(item, true, false);
+		}
+	}
+
+	return countTaken;
+}
+
+void queueItemDestroy(Character* const* owners, size_t ownerCount, GameData* itemData, int count)
+{
+	if (ownerCount == 0 || count <= 0)
+		return;
+
+	boost::lock_guard<boost::mutex> lock(destroyQueueLock);
+
+	// there's rarely more than a few requests per frame
+	for (size_t i = 0; i < destroyQueue.size(); ++i)
+	{
+		DestroyRequest& request = destroyQueue[i];
+		if (request.itemData == itemData && request.owners.size() == ownerCount
+			&& std::equal(request.owners.begin(), request.owners.end(), owners))
+		{
+			request.count += count;
+			return;
+		}
+	}
+
+	DestroyRequest request;
+	request.owners.assign(owners, owners + ownerCount);
+	request.itemData = itemData;
+	request.count = count;
+	destroyQueue.push_back(request);
+}
+
+bool flushItemDestroys()
+{
+	std::vector<DestroyRequest> requests;
+	{
+		boost::lock_guard<boost::mutex> lock(destroyQueueLock);
+		if (destroyQueue.empty())
+			return false;
+		requests.swap(destroyQueue);
+	}
+
+	bool destroyed = false;
+	std::vector<ItemStackPlan> plan;
+	for (size_t r = 0; r < requests.size(); ++r)
+	{
+		plan.clear();
+		destroyed |= planItemStacks(&requests[r].owners[0], requests[r].owners.size(), requests[r].itemData, requests[r].count, plan) > 0;
+
+		for (size_t i = 0; i < plan.size(); ++i)
+		{
+			Item* item = plan[i].item;
+			if (plan[i].quantity < item->quantity)
+			{
+				item->quantity -= plan[i].quantity;
+			}
+			else
+			{
+				// get rid of inventory references or something, no idea if this is needed but it seems like a good idea
+				plan[i].owner->dropItem(item);
+				ou->destroy(item, false, "Destroy item event");
+			}
+		}
+	}
+	return destroyed;
+}
+
+void clearItemDestroys()
+{
+	boost::lock_guard<boost::mutex> lock(destroyQueueLock);
+	destroyQueue.clear();
+}
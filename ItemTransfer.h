@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class Character;
+class GameData;
+class Item;
+
+// A stack picked to be moved or destroyed, the stack is split if quantity is less than item->quantity
+struct ItemStackPlan
+{
+	Character* owner;
+	Item* item;
+	int quantity;
+};
+
+// Picks stacks of itemData from owners, in order, until count items are covered
+// Each inventory is walked once rather than searched again for every stack. At most one stack, the last, is split.
+// returns the number of items planned
+int planItemStacks(Character* const* owners, size_t ownerCount, GameData* itemData, int count, std::vector<ItemStackPlan>& plan);
+
+// moves up to count of itemData from givers to taker
+// returns num items taken
+int takeItems(Character* const* givers, size_t giverCount, Character* taker, GameData* itemData, int count);
+
+// Queues up to count of itemData to be destroyed from owners, taken in order like planItemStacks
+// Requests are merged per (owners, item) and applied by flushItemDestroys once a line's effects are done, each
+// with a single pass over the inventories, so a line destroying the same item several times walks them once.
+// Inventories still hold the items until the flush.
+void queueItemDestroy(Character* const* owners, size_t ownerCount, GameData* itemData, int count);
+// called after a line's effects, before anything can check the inventories again
+// returns true if anything was destroyed
+bool flushItemDestroys();
+// drops queued requests, their characters don't survive a load
+void clearItemDestroys();
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include <cstdlib>
+#include <kenshi/util/lektor.h>
+#include <boost/thread/tss.hpp>
+
+// RAII handle to a reusable lektor for engine functions that fill one in
+// Buffers come from a per-thread pool and go back with their allocation intact, so once the pool has warmed up
+// queries don't touch the heap. Buffers are always initialised, emptied on release, and only freed by the pool.
+template<typename T>
+class ScratchLektor
+{
+public:
+	ScratchLektor()
+		: buffer(acquire())
+	{
+	}
+
+	~ScratchLektor()
+	{
+		release(buffer);
+	}
+
+	lektor<T>& get() { return *buffer; }
+	operator lektor<T>&() { return *buffer; }
+
+	int size() const { return buffer->size(); }
+	T& operator[](int i) { return (*buffer)[i]; }
+
+private:
+	// not copyable
+	ScratchLektor(const ScratchLektor&);
+	ScratchLektor& operator=(const ScratchLektor&);
+
+	struct Pool
+	{
+		std::vector<lektor<T>*> free;
+
+		~Pool()
+		{
+			for (size_t i = 0; i < free.size(); ++i)
+			{
+				// engine grows lektors with realloc
+				if (free[i]->stuff)
+					::free(free[i]->stuff);
+				delete free[i];
+			}
+		}
+	};
+
+	static Pool& pool()
+	{
+		static boost::thread_specific_ptr<Pool> pools;
+		Pool* threadPool = pools.get();
+		if (!threadPool)
+		{
+			threadPool = new Pool();
+			pools.reset(threadPool);
+		}
+		return *threadPool;
+	}
+
+	static lektor<T>* acquire()
+	{
+		Pool& threadPool = pool();
+		if (!threadPool.free.empty())
+		{
+			lektor<T>* reused = threadPool.free.back();
+			threadPool.free.pop_back();
+			return reused;
+		}
+
+		lektor<T>* created = new lektor<T>();
+		created->maxSize = 0;
+		created->count = 0;
+		created->stuff = nullptr;
+		return created;
+	}
+
+	static void release(lektor<T>* released)
+	{
+		// keep the allocation for the next query
+		released->count = 0;
+		pool().free.push_back(released);
+	}
+
+	lektor<T>* buffer;
+};
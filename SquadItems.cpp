@@ -0,0 +1,118 @@
+#include "SquadItems.h"
+#include "Frame.h"
+#include "SquadSnapshot.h"
+
+#include <kenshi/Gear.h>
+#include <kenshi/Inventory.h>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace
+{
+	boost::atomic<uint32_t> itemsEpoch(0);
+
+	struct CachedItems
+	{
+		ActivePlatoon* platoon;
+		Ogre::Vector3 position;
+		uint32_t frame;
+		uint32_t epoch;
+		boost::unordered_map<GameData*, SquadItemCount> counts;
+	};
+
+	// same as SquadSnapshot, only a couple of squads are looked at per frame
+	static const int ITEMS_CACHE_SIZE = 8;
+
+	struct ItemsCache
+	{
+		CachedItems entries[ITEMS_CACHE_SIZE];
+		// round robin replacement
+		int next;
+
+		ItemsCache()
+			: next(0)
+		{
+			for (int i = 0; i < ITEMS_CACHE_SIZE; ++i)
+			{
+				entries[i].platoon = nullptr;
+				entries[i].position = Ogre::Vector3(0, 0, 0);
+				entries[i].frame = 0;
+				entries[i].epoch = 0;
+			}
+		}
+	};
+
+	boost::thread_specific_ptr<ItemsCache> itemsCache;
+
+	void buildCounts(ActivePlatoon* platoon, const Ogre::Vector3& position, CachedItems& entry)
+	{
+		entry.counts.clear();
+
+		const std::vector<Character*>& squad = getSquadMembers(platoon, position);
+		for (size_t m = 0; m < squad.size(); ++m)
+		{
+			Character* member = squad[m];
+			if (member->inventory == nullptr)
+				continue;
+
+			lektor<Item*>& items = member->inventory->getAllItems();
+			for (int i = 0; i < items.size(); ++i)
+			{
+				Item* item = items[i];
+				// same stacks planItemStacks would take
+				if (item == nullptr || item->quantity <= 0)
+					continue;
+
+				SquadItemCount& count = entry.counts[item->data];
+				count.total += item->quantity;
+				if (count.holders.empty() || count.holders.back() != member)
+					count.holders.push_back(member);
+			}
+		}
+	}
+}
+
+const SquadItemCount* findSquadItems(ActivePlatoon* platoon, const Ogre::Vector3& position, GameData* itemData)
+{
+	if (!platoon)
+		return nullptr;
+
+	ItemsCache* cache = itemsCache.get();
+	if (!cache)
+	{
+		cache = new ItemsCache();
+		itemsCache.reset(cache);
+	}
+
+	const uint32_t frame = getFrame();
+	const uint32_t epoch = itemsEpoch.load(boost::memory_order_acquire);
+	CachedItems* found = nullptr;
+	for (int i = 0; i < ITEMS_CACHE_SIZE; ++i)
+	{
+		CachedItems& entry = cache->entries[i];
+		if (entry.platoon == platoon && entry.frame == frame && entry.epoch == epoch && entry.position == position)
+		{
+			found = &entry;
+			break;
+		}
+	}
+
+	if (!found)
+	{
+		found = &cache->entries[cache->next];
+		cache->next = (cache->next + 1) % ITEMS_CACHE_SIZE;
+		found->platoon = platoon;
+		found->position = position;
+		found->frame = frame;
+		found->epoch = epoch;
+		buildCounts(platoon, position, *found);
+	}
+
+	boost::unordered_map<GameData*, SquadItemCount>::const_iterator iter = found->counts.find(itemData);
+	return iter == found->counts.end() ? nullptr : &iter->second;
+}
+
+void invalidateSquadItems()
+{
+	itemsEpoch.fetch_add(1, boost::memory_order_release);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <kenshi/Character.h>
+
+class ActivePlatoon;
+class GameData;
+
+// How much of an item the squad members returned by getSquadMembers hold between them
+struct SquadItemCount
+{
+	int total;
+	// members holding any, in squad order
+	std::vector<Character*> holders;
+
+	SquadItemCount() : total(0) {}
+};
+
+// Item counts of every member's inventory keyed by item GameData, built with a single pass over the inventories the
+// first time a squad is asked about in a frame. The index is rebuilt on the next frame and after invalidateSquadItems,
+// which must be called after anything this plugin does to an inventory. Cached per thread, the pointer is valid
+// until the next call.
+// returns nullptr if no member holds itemData
+const SquadItemCount* findSquadItems(ActivePlatoon* platoon, const Ogre::Vector3& position, GameData* itemData);
+
+inline int getSquadItemCount(ActivePlatoon* platoon, const Ogre::Vector3& position, GameData* itemData)
+{
+	const SquadItemCount* items = findSquadItems(platoon, position, itemData);
+	return items ? items->total : 0;
+}
+
+// call after changing a character's inventory
+void invalidateSquadItems();
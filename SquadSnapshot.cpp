@@ -0,0 +1,82 @@
+#include "SquadSnapshot.h"
+#include "Frame.h"
+#include "ScratchLektor.h"
+
+#include <kenshi/Character.h>
+#include <kenshi/Platoon.h>
+#include <boost/thread/tss.hpp>
+
+namespace
+{
+	struct CachedSquad
+	{
+		ActivePlatoon* platoon;
+		Ogre::Vector3 position;
+		uint32_t frame;
+		std::vector<Character*> members;
+	};
+
+	// dialogue evaluation usually only looks at a couple of squads per frame
+	static const int SQUAD_CACHE_SIZE = 8;
+
+	struct SquadCache
+	{
+		CachedSquad entries[SQUAD_CACHE_SIZE];
+		// round robin replacement
+		int next;
+
+		SquadCache()
+			: next(0)
+		{
+			for (int i = 0; i < SQUAD_CACHE_SIZE; ++i)
+			{
+				entries[i].platoon = nullptr;
+				entries[i].position = Ogre::Vector3(0, 0, 0);
+				entries[i].frame = 0;
+			}
+		}
+	};
+
+	boost::thread_specific_ptr<SquadCache> squadCache;
+}
+
+const std::vector<Character*>& getSquadMembers(ActivePlatoon* platoon, const Ogre::Vector3& position)
+{
+	SquadCache* cache = squadCache.get();
+	if (!cache)
+	{
+		cache = new SquadCache();
+		squadCache.reset(cache);
+	}
+
+	const uint32_t frame = getFrame();
+	for (int i = 0; i < SQUAD_CACHE_SIZE; ++i)
+	{
+		CachedSquad& entry = cache->entries[i];
+		if (entry.platoon == platoon && entry.frame == frame && entry.position == position)
+			return entry.members;
+	}
+
+	CachedSquad& entry = cache->entries[cache->next];
+	cache->next = (cache->next + 1) % SQUAD_CACHE_SIZE;
+	entry.platoon = platoon;
+	entry.position = position;
+	entry.frame = frame;
+	entry.members.clear();
+
+	if (platoon)
+	{
+		ScratchLektor<RootObject*> characters;
+		platoon->getCharactersInArea(characters, position, SQUAD_CHECK_RADIUS, false);
+
+		// cast once here rather than in every condition
+		for (int i = 0; i < characters.size(); ++i)
+		{
+			Character* squadChar = dynamic_cast<Character*>(characters[i]);
+			if (squadChar)
+				entry.members.push_back(squadChar);
+		}
+	}
+
+	return entry.members;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+#include <kenshi/Character.h>
+
+class ActivePlatoon;
+
+// couldn't find T_WHOLE_SQUAD radius but interjection radius is similar and appears to be 900
+static const float SQUAD_CHECK_RADIUS = 900.0f;
+
+// Returns the characters of platoon within SQUAD_CHECK_RADIUS of position
+// The proximity query is only run once per (platoon, position, frame), so every whole squad condition on every
+// candidate line in a dialogue pass shares it. Cached per thread, the reference is valid until the next call.
+const std::vector<Character*>& getSquadMembers(ActivePlatoon* platoon, const Ogre::Vector3& position);
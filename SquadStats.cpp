@@ -0,0 +1,176 @@
+#include "SquadStats.h"
+#include "ConditionRegistry.h"
+#include "Frame.h"
+#include "SquadSnapshot.h"
+
+#include <vector>
+#include <kenshi/CharStats.h>
+#include <boost/atomic.hpp>
+#include <boost/thread/tss.hpp>
+
+// x64 always has SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SQUAD_STATS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	boost::atomic<uint32_t> statsEpoch(0);
+
+	// tags past this are read again on every check
+	static const int MAX_STAT_COLUMNS = 64;
+
+	struct CachedStats
+	{
+		ActivePlatoon* platoon;
+		Ogre::Vector3 position;
+		uint32_t frame;
+		uint32_t epoch;
+		// bit per stat, by unmodified
+		uint64_t filled[2];
+		// in getSquadMembers order
+		std::vector<int32_t> columns[2][MAX_STAT_COLUMNS];
+	};
+
+	// same as SquadSnapshot, only a couple of squads are looked at per frame
+	static const int STATS_CACHE_SIZE = 8;
+
+	struct StatsCache
+	{
+		CachedStats entries[STATS_CACHE_SIZE];
+		// round robin replacement
+		int next;
+
+		StatsCache()
+			: next(0)
+		{
+			for (int i = 0; i < STATS_CACHE_SIZE; ++i)
+			{
+				entries[i].platoon = nullptr;
+				entries[i].position = Ogre::Vector3(0, 0, 0);
+				entries[i].frame = 0;
+				entries[i].epoch = 0;
+				entries[i].filled[0] = 0;
+				entries[i].filled[1] = 0;
+			}
+		}
+	};
+
+	boost::thread_specific_ptr<StatsCache> statsCache;
+
+	int readStat(Character* member, int stat, bool unmodified)
+	{
+		// same truncation as the stat level readers
+		return (int)member->getStats()->getStat((StatsEnumerated)stat, unmodified);
+	}
+
+#ifdef SQUAD_STATS_SSE2
+	template<int Comparison>
+	__m128i compareLanes(__m128i stats, __m128i value);
+
+	template<>
+	__m128i compareLanes<0>(__m128i stats, __m128i value) { return _mm_cmpeq_epi32(stats, value); }
+	template<>
+	__m128i compareLanes<1>(__m128i stats, __m128i value) { return _mm_cmplt_epi32(stats, value); }
+	template<>
+	__m128i compareLanes<2>(__m128i stats, __m128i value) { return _mm_cmpgt_epi32(stats, value); }
+#endif
+
+	template<int Comparison>
+	bool anyPasses(const std::vector<int32_t>& column, int value)
+	{
+		const int32_t* stats = column.empty() ? nullptr : &column[0];
+		const size_t count = column.size();
+		size_t i = 0;
+#ifdef SQUAD_STATS_SSE2
+		// eight members per branch
+		const __m128i values = _mm_set1_epi32(value);
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m128i low = compareLanes<Comparison>(_mm_loadu_si128((const __m128i*)(stats + i)), values);
+			const __m128i high = compareLanes<Comparison>(_mm_loadu_si128((const __m128i*)(stats + i + 4)), values);
+			if (_mm_movemask_epi8(_mm_or_si128(low, high)))
+				return true;
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			if (compareValues<Comparison>(stats[i], value))
+				return true;
+		}
+		return false;
+	}
+
+	CachedStats& findEntry(ActivePlatoon* platoon, const Ogre::Vector3& position)
+	{
+		StatsCache* cache = statsCache.get();
+		if (!cache)
+		{
+			cache = new StatsCache();
+			statsCache.reset(cache);
+		}
+
+		const uint32_t frame = getFrame();
+		const uint32_t epoch = statsEpoch.load(boost::memory_order_acquire);
+		for (int i = 0; i < STATS_CACHE_SIZE; ++i)
+		{
+			CachedStats& entry = cache->entries[i];
+			if (entry.platoon == platoon && entry.frame == frame && entry.epoch == epoch && entry.position == position)
+				return entry;
+		}
+
+		CachedStats& entry = cache->entries[cache->next];
+		cache->next = (cache->next + 1) % STATS_CACHE_SIZE;
+		entry.platoon = platoon;
+		entry.position = position;
+		entry.frame = frame;
+		entry.epoch = epoch;
+		entry.filled[0] = 0;
+		entry.filled[1] = 0;
+		return entry;
+	}
+}
+
+bool anySquadStat(ActivePlatoon* platoon, const Ogre::Vector3& position, int stat, bool unmodified, int comparison, int value)
+{
+	if (!platoon)
+		return false;
+
+	std::vector<int32_t> uncached;
+	std::vector<int32_t>* column = &uncached;
+	bool fill = true;
+	if ((unsigned int)stat < (unsigned int)MAX_STAT_COLUMNS)
+	{
+		CachedStats& entry = findEntry(platoon, position);
+		const int form = unmodified ? 1 : 0;
+		const uint64_t bit = 1ull << stat;
+		column = &entry.columns[form][stat];
+		fill = !(entry.filled[form] & bit);
+		entry.filled[form] |= bit;
+	}
+
+	if (fill)
+	{
+		const std::vector<Character*>& squad = getSquadMembers(platoon, position);
+		column->resize(squad.size());
+		for (size_t i = 0; i < squad.size(); ++i)
+			(*column)[i] = readStat(squad[i], stat, unmodified);
+	}
+
+	switch (comparison)
+	{
+		case 0:
+			return anyPasses<0>(*column, value);
+		case 1:
+			return anyPasses<1>(*column, value);
+		case 2:
+			return anyPasses<2>(*column, value);
+	}
+	return false;
+}
+
+void invalidateSquadStats()
+{
+	statsEpoch.fetch_add(1, boost::memory_order_release);
+}
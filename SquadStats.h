@@ -0,0 +1,15 @@
+#pragma once
+
+#include <kenshi/Character.h>
+
+class ActivePlatoon;
+
+// Stats of the squad members returned by getSquadMembers, as one contiguous column per stat and form holding the
+// values DC_STAT_LEVEL_* compare, truncated to int. A whole squad stat condition is then a SIMD compare over the
+// column instead of a getStat call per member. A column is filled the first time it's asked about in a frame and
+// again after invalidateSquadStats. Cached per thread.
+// comparison is a comparisonIndex, true if any member's stat passes
+bool anySquadStat(ActivePlatoon* platoon, const Ogre::Vector3& position, int stat, bool unmodified, int comparison, int value);
+
+// call after anything that can change stats, like equipment
+void invalidateSquadStats();
@@ -0,0 +1,510 @@
+#include "Trace.h"
+#include "ConditionRegistry.h"
+#include "Frame.h"
+#include "HookStats.h"
+#include "SquadSnapshot.h"
+#include "VariableStore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+#include <Debug.h>
+#include <kenshi/Character.h>
+#include <kenshi/Dialogue.h>
+#include <kenshi/GameData.h>
+#include <kenshi/Gear.h>
+#include <kenshi/Inventory.h>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+bool traceEnabled = false;
+
+namespace
+{
+	typedef std::vector<char> TraceBuffer;
+
+	void put8(TraceBuffer& out, uint32_t value)
+	{
+		out.push_back((char)(value & 0xFF));
+	}
+
+	void put16(TraceBuffer& out, uint32_t value)
+	{
+		put8(out, value);
+		put8(out, value >> 8);
+	}
+
+	void put32(TraceBuffer& out, uint32_t value)
+	{
+		put16(out, value);
+		put16(out, value >> 16);
+	}
+
+	// references compileLine and the world state compiler read, others aren't written
+	const char* tracedReferences[] = {
+		"conditions",
+		"variable equals",
+		"variable less than",
+		"variable greater than",
+		"squad has item",
+		"take item",
+		"take item from squad",
+		"destroy item",
+		"destroy item from squad",
+		"set variable",
+		"add to variable"
+	};
+	const int TRACED_REFERENCE_COUNT = sizeof(tracedReferences) / sizeof(tracedReferences[0]);
+
+	struct TraceCall
+	{
+		HookId hook;
+		uint32_t data;
+		uint32_t me;
+		uint32_t target;
+		bool wordswap;
+		uint64_t start;
+		TraceBuffer records;
+		// already in records
+		boost::unordered_set<uint32_t> squads;
+		boost::unordered_set<std::pair<uint32_t, uint32_t> > stacks;
+	};
+
+	// hooks can be nested through the vanilla functions they call
+	boost::thread_specific_ptr<std::vector<TraceCall> > threadCalls;
+
+	// everything below is guarded by traceLock
+	boost::mutex traceLock;
+	FILE* traceFile = nullptr;
+	boost::unordered_map<std::string, uint32_t> stringIds;
+	boost::unordered_map<GameData*, uint32_t> dataIds;
+	boost::unordered_map<Character*, uint32_t> characterIds;
+	uint32_t lastFrame = 0;
+
+	void writeRecord(const TraceBuffer& record)
+	{
+		fwrite(&record[0], 1, record.size(), traceFile);
+	}
+
+	uint32_t internString(const std::string& value)
+	{
+		boost::unordered_map<std::string, uint32_t>::iterator iter = stringIds.find(value);
+		if (iter != stringIds.end())
+			return iter->second;
+
+		const uint32_t id = (uint32_t)stringIds.size() + 1;
+		stringIds.emplace(value, id);
+
+		const size_t length = std::min(value.size(), (size_t)0xFFFF);
+		TraceBuffer record;
+		put8(record, TR_STRING);
+		put32(record, id);
+		put16(record, (uint32_t)length);
+		record.insert(record.end(), value.begin(), value.begin() + length);
+		writeRecord(record);
+		return id;
+	}
+
+	// line is only given for dialogue lines
+	uint32_t internData(GameData* data, DialogLineData* line = nullptr)
+	{
+		if (!data)
+			return TRACE_NONE;
+		boost::unordered_map<GameData*, uint32_t>::iterator iter = dataIds.find(data);
+		if (iter != dataIds.end())
+			return iter->second;
+
+		const uint32_t id = (uint32_t)dataIds.size() + 1;
+		dataIds.emplace(data, id);
+
+		// referenced data first so references can be resolved as the trace is read
+		std::vector<std::pair<uint32_t, const GameDataReference*> > references;
+		for (int r = 0; r < TRACED_REFERENCE_COUNT; ++r)
+		{
+			ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator refIter = data->objectReferences.find(tracedReferences[r]);
+			if (refIter == data->objectReferences.end())
+				continue;
+			const uint32_t name = internString(refIter->first);
+			for (size_t i = 0; i < refIter->second.size(); ++i)
+			{
+				internData(refIter->second[i].ptr);
+				references.push_back(std::make_pair(name, &refIter->second[i]));
+			}
+		}
+
+		std::vector<std::pair<uint32_t, int> > idata;
+		for (ogre_unordered_map<std::string, int>::type::iterator idataIter = data->idata.begin(); idataIter != data->idata.end(); ++idataIter)
+			idata.push_back(std::make_pair(internString(idataIter->first), idataIter->second));
+
+		TraceBuffer record;
+		put8(record, TR_DATA);
+		put32(record, id);
+		put32(record, internString(data->stringID));
+		put32(record, (uint32_t)data->type);
+
+		put16(record, (uint32_t)idata.size());
+		for (size_t i = 0; i < idata.size(); ++i)
+		{
+			put32(record, idata[i].first);
+			put32(record, (uint32_t)idata[i].second);
+		}
+
+		const int conditionCount = line ? line->conditions.size() : 0;
+		put16(record, (uint32_t)conditionCount);
+		for (int i = 0; i < conditionCount; ++i)
+		{
+			const DialogLineData::DialogCondition* condition = line->conditions[i];
+			put32(record, (uint32_t)condition->key);
+			put8(record, (uint32_t)condition->compareBy);
+			put8(record, (uint32_t)condition->who);
+			put32(record, (uint32_t)condition->tag);
+			put32(record, (uint32_t)condition->value);
+		}
+
+		put16(record, (uint32_t)references.size());
+		for (size_t i = 0; i < references.size(); ++i)
+		{
+			put32(record, references[i].first);
+			put32(record, references[i].second->ptr ? dataIds[references[i].second->ptr] : TRACE_NONE);
+			put32(record, (uint32_t)references[i].second->values[0]);
+		}
+
+		writeRecord(record);
+		return id;
+	}
+
+	uint32_t characterId(Character* character)
+	{
+		if (!character)
+			return TRACE_NONE;
+		// a character allocated at a dead one's address shares its id, the replayer overwrites its state per call
+		boost::unordered_map<Character*, uint32_t>::iterator iter = characterIds.find(character);
+		if (iter != characterIds.end())
+			return iter->second;
+		const uint32_t id = (uint32_t)characterIds.size() + 1;
+		characterIds.emplace(character, id);
+		return id;
+	}
+
+	void writeVariables(bool loaded)
+	{
+		std::vector<GameData*> variables;
+		variableStore.getVariables(variables);
+
+		std::vector<uint32_t> ids;
+		for (size_t slot = 0; slot < variables.size(); ++slot)
+			ids.push_back(internData(variables[slot]));
+
+		TraceBuffer record;
+		put8(record, TR_VARIABLES);
+		put8(record, loaded ? 1 : 0);
+		put32(record, (uint32_t)variables.size());
+		for (size_t slot = 0; slot < variables.size(); ++slot)
+		{
+			put32(record, ids[slot]);
+			put8(record, variableStore.hasValue((int)slot) ? 1 : 0);
+			put32(record, (uint32_t)variableStore.get((int)slot));
+		}
+		writeRecord(record);
+	}
+
+	// traceLock must be held
+	TraceCall& beginCall(HookId hook, uint32_t data, Character* me, Character* target, bool wordswap)
+	{
+		const uint32_t frame = getFrame();
+		if (frame != lastFrame)
+		{
+			lastFrame = frame;
+			TraceBuffer record;
+			put8(record, TR_FRAME);
+			writeRecord(record);
+			// keep what was recorded if the game crashes
+			fflush(traceFile);
+		}
+
+		std::vector<TraceCall>* calls = threadCalls.get();
+		if (!calls)
+		{
+			calls = new std::vector<TraceCall>();
+			threadCalls.reset(calls);
+		}
+		calls->push_back(TraceCall());
+		TraceCall& call = calls->back();
+		call.hook = hook;
+		call.data = data;
+		call.me = characterId(me);
+		call.target = characterId(target);
+		call.wordswap = wordswap;
+		call.start = 0;
+		return call;
+	}
+
+	// returns the members the plugin sees
+	std::vector<Character*> writeSquad(TraceCall& call, Character* owner, const Ogre::Vector3& position)
+	{
+		ActivePlatoon* platoon = owner->getPlatoon();
+		std::vector<Character*> squad = getSquadMembers(platoon, position);
+
+		const uint32_t ownerId = characterId(owner);
+		if (call.squads.insert(ownerId).second)
+		{
+			put8(call.records, TR_SQUAD);
+			put32(call.records, ownerId);
+			put8(call.records, platoon ? 1 : 0);
+			put32(call.records, (uint32_t)squad.size());
+			for (size_t i = 0; i < squad.size(); ++i)
+				put32(call.records, characterId(squad[i]));
+		}
+		return squad;
+	}
+
+	void writeItemStacks(TraceCall& call, Character* owner, GameData* itemData)
+	{
+		const uint32_t ownerId = characterId(owner);
+		const uint32_t itemId = internData(itemData);
+		if (!call.stacks.insert(std::make_pair(ownerId, itemId)).second)
+			return;
+
+		std::vector<int> quantities;
+		if (owner->inventory)
+		{
+			lektor<Item*>& items = owner->inventory->getAllItems();
+			for (int i = 0; i < items.size(); ++i)
+			{
+				if (items[i] && items[i]->data == itemData)
+					quantities.push_back(items[i]->quantity);
+			}
+		}
+
+		put8(call.records, TR_ITEM_STACKS);
+		put32(call.records, ownerId);
+		put32(call.records, itemId);
+		put32(call.records, (uint32_t)quantities.size());
+		for (size_t i = 0; i < quantities.size(); ++i)
+			put32(call.records, (uint32_t)quantities[i]);
+	}
+
+	void writeSquadItemStacks(TraceCall& call, Character* owner, const Ogre::Vector3& position, GameData* itemData)
+	{
+		const std::vector<Character*> squad = writeSquad(call, owner, position);
+		for (size_t i = 0; i < squad.size(); ++i)
+			writeItemStacks(call, squad[i], itemData);
+	}
+
+	void writeFact(TraceCall& call, const ConditionType& type, int key, int comparison, Character* check, Character* target, int tag, int value)
+	{
+		put8(call.records, TR_FACT);
+		put32(call.records, (uint32_t)key);
+		put8(call.records, (uint32_t)comparison);
+		put32(call.records, characterId(check));
+		put32(call.records, characterId(target));
+		put32(call.records, (uint32_t)tag);
+		put32(call.records, (uint32_t)value);
+		put8(call.records, type.evaluators[comparison](type, check, target, tag, value) ? 1 : 0);
+	}
+
+	// same speaker resolution as checkDialogCondition and checkTagCondition
+	void writeConditionFacts(TraceCall& call, ConditionHookEnum hook, int key, ComparisonEnum compareBy, TalkerEnum who, int tag, int value,
+		Character* me, Character* target)
+	{
+		Character* check = me;
+		Character* checkTarget = target;
+		if (who != TalkerEnum::T_ME && who != TalkerEnum::T_WHOLE_SQUAD)
+			std::swap(check, checkTarget);
+		// evaluation stops before a missing speaker
+		if (!check)
+			return;
+
+		const ConditionType* type = getConditionType(key);
+		if (type && type->hook != hook)
+			type = nullptr;
+		const int comparison = comparisonIndex(compareBy);
+
+		if (who == TalkerEnum::T_WHOLE_SQUAD)
+		{
+			// vanilla whole squad conditions only need the squad
+			const std::vector<Character*> squad = writeSquad(call, check, check->getPosition());
+			if (type && comparison >= 0)
+			{
+				for (size_t i = 0; i < squad.size(); ++i)
+					writeFact(call, *type, key, comparison, squad[i], checkTarget, tag, value);
+			}
+		}
+		else if (type && comparison >= 0)
+		{
+			writeFact(call, *type, key, comparison, check, checkTarget, tag, value);
+		}
+	}
+
+	void startCallTimer(TraceCall& call)
+	{
+		call.start = readHookTicks();
+	}
+}
+
+bool startTrace(const char* path)
+{
+	boost::lock_guard<boost::mutex> lock(traceLock);
+	traceFile = fopen(path, "wb");
+	if (!traceFile)
+		return false;
+
+	TraceBuffer record;
+	put8(record, TR_HEADER);
+	record.push_back('B');
+	record.push_back('F');
+	record.push_back('X');
+	record.push_back('T');
+	put32(record, TRACE_VERSION);
+	writeRecord(record);
+
+	writeVariables(false);
+	traceEnabled = true;
+	DebugLog("Trace: writing to " + std::string(path));
+	return true;
+}
+
+void traceVariables()
+{
+	if (!traceEnabled)
+		return;
+	boost::lock_guard<boost::mutex> lock(traceLock);
+	writeVariables(true);
+}
+
+void traceCheckConditions(DialogLineData* line, Character* me, Character* target, bool isWordswap)
+{
+	boost::lock_guard<boost::mutex> lock(traceLock);
+	TraceCall& call = beginCall(HOOK_CHECK_CONDITIONS, internData(line->getGameData(), line), me, target, isWordswap);
+
+	for (int i = 0; i < line->conditions.size(); ++i)
+	{
+		const DialogLineData::DialogCondition* condition = line->conditions[i];
+		writeConditionFacts(call, CONDITION_HOOK_CHECK_CONDITIONS, condition->key, condition->compareBy, condition->who,
+			condition->tag, condition->value, me, target);
+	}
+	startCallTimer(call);
+}
+
+void traceCheckTags(DialogLineData* line, Character* me, Character* target)
+{
+	boost::lock_guard<boost::mutex> lock(traceLock);
+	GameData* lineData = line->getGameData();
+	TraceCall& call = beginCall(HOOK_CHECK_TAGS, internData(lineData, line), me, target, false);
+
+	// decoded the same way as compileLine
+	ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter = lineData->objectReferences.find("conditions");
+	if (iter != lineData->objectReferences.end())
+	{
+		for (size_t i = 0; i < iter->second.size(); ++i)
+		{
+			ogre_unordered_map<std::string, int>::type& idata = iter->second[i].ptr->idata;
+			ogre_unordered_map<std::string, int>::type::iterator nameIter = idata.find("condition name");
+			if (nameIter == idata.end())
+				continue;
+			ogre_unordered_map<std::string, int>::type::iterator compareIter = idata.find("compare by");
+			ogre_unordered_map<std::string, int>::type::iterator whoIter = idata.find("who");
+			ogre_unordered_map<std::string, int>::type::iterator tagIter = idata.find("tag");
+
+			writeConditionFacts(call, CONDITION_HOOK_CHECK_TAGS, nameIter->second,
+				compareIter == idata.end() ? ComparisonEnum::CE_EQUALS : (ComparisonEnum)compareIter->second,
+				whoIter == idata.end() ? TalkerEnum::T_ME : (TalkerEnum)whoIter->second,
+				tagIter == idata.end() ? 0 : tagIter->second, iter->second[i].values[0], me, target);
+		}
+	}
+
+	// the target's squad around me, like checkItemCondition
+	iter = lineData->objectReferences.find("squad has item");
+	if (iter != lineData->objectReferences.end() && me && target)
+	{
+		for (size_t i = 0; i < iter->second.size(); ++i)
+			writeSquadItemStacks(call, target, me->getPosition(), iter->second[i].ptr);
+	}
+	startCallTimer(call);
+}
+
+void traceIsTrue(GameData* stateData)
+{
+	boost::lock_guard<boost::mutex> lock(traceLock);
+	TraceCall& call = beginCall(HOOK_IS_TRUE, internData(stateData), nullptr, nullptr, false);
+	startCallTimer(call);
+}
+
+void traceDoActions(Dialogue* dialog, DialogLineData* line)
+{
+	boost::lock_guard<boost::mutex> lock(traceLock);
+	GameData* lineData = line->getGameData();
+	Character* me = dialog->me;
+	Character* target = dialog->getConversationTarget().getCharacter();
+	TraceCall& call = beginCall(HOOK_DO_ACTIONS, internData(lineData, line), me, target, false);
+
+	// stacks doRefAction takes or destroys from
+	if (target)
+	{
+		ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type::iterator iter;
+		iter = lineData->objectReferences.find("take item");
+		if (iter != lineData->objectReferences.end() && me)
+		{
+			for (size_t i = 0; i < iter->second.size(); ++i)
+				writeItemStacks(call, target, iter->second[i].ptr);
+		}
+		iter = lineData->objectReferences.find("take item from squad");
+		if (iter != lineData->objectReferences.end() && me)
+		{
+			for (size_t i = 0; i < iter->second.size(); ++i)
+				writeSquadItemStacks(call, target, me->getPosition(), iter->second[i].ptr);
+		}
+		iter = lineData->objectReferences.find("destroy item");
+		if (iter != lineData->objectReferences.end())
+		{
+			for (size_t i = 0; i < iter->second.size(); ++i)
+				writeItemStacks(call, target, iter->second[i].ptr);
+		}
+		iter = lineData->objectReferences.find("destroy item from squad");
+		if (iter != lineData->objectReferences.end())
+		{
+			for (size_t i = 0; i < iter->second.size(); ++i)
+				writeSquadItemStacks(call, target, target->getPosition(), iter->second[i].ptr);
+		}
+	}
+	startCallTimer(call);
+}
+
+void recordVanilla(bool result)
+{
+	std::vector<TraceCall>* calls = threadCalls.get();
+	if (!calls || calls->empty())
+		return;
+	TraceBuffer& records = calls->back().records;
+	put8(records, TR_VANILLA);
+	put8(records, result ? 1 : 0);
+}
+
+void traceResult(bool result)
+{
+	std::vector<TraceCall>* calls = threadCalls.get();
+	if (!calls || calls->empty())
+		return;
+
+	TraceCall& call = calls->back();
+	const uint64_t ns = hookTicksToNs(readHookTicks() - call.start);
+	put8(call.records, TR_CALL);
+	put8(call.records, call.hook);
+	put32(call.records, call.data);
+	put32(call.records, call.me);
+	put32(call.records, call.target);
+	put8(call.records, call.wordswap ? 1 : 0);
+	put8(call.records, result ? 1 : 0);
+	put32(call.records, (uint32_t)std::min(ns, (uint64_t)0xFFFFFFFF));
+
+	{
+		boost::lock_guard<boost::mutex> lock(traceLock);
+		writeRecord(call.records);
+	}
+	calls->pop_back();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+
+class Character;
+class Dialogue;
+class DialogLineData;
+class GameData;
+
+// Opt-in binary trace of checkConditions, checkTags, isTrue and _doActions calls, replayed offline by
+// bench/bfrizz_replay against the plugin's own condition logic.
+// Lines and world states are written once with the references their conditions and effects are compiled from.
+// Before each call the trace holds the result of every extended condition on the line for every character it could
+// be checked against, the squads and item stacks the call reads, and the vanilla results the hook passes through.
+// Calls are buffered per thread and appended to the file as a unit.
+// Recording evaluates every condition on a line up front, so it's much slower than normal play.
+
+// record types, each is a type byte followed by the fields listed, little endian
+enum TraceRecordEnum
+{
+	// magic "BFXT", u32 version
+	TR_HEADER,
+	// u32 id, u16 length, bytes
+	TR_STRING,
+	// u32 id, u32 stringID, i32 item type, u16 idata count, per idata: u32 key, i32 value
+	// u16 condition count, per condition: i32 key, u8 compare by, u8 who, i32 tag, i32 value
+	// u16 reference count, per reference: u32 name, u32 target, i32 value
+	// referenced data is written first, only DialogLineData has conditions
+	TR_DATA,
+	// u8 after a load, u32 count, per variable: u32 data, u8 has value, i32 value
+	TR_VARIABLES,
+	// the game advanced at least one frame
+	TR_FRAME,
+	// i32 key, u8 comparison index, u32 check, u32 target, i32 tag, i32 value, u8 result
+	TR_FACT,
+	// u32 owner, u8 has platoon, u32 count, per member: u32 character
+	TR_SQUAD,
+	// u32 character, u32 item data, u32 count, per stack: i32 quantity
+	TR_ITEM_STACKS,
+	// u8 result of the vanilla function
+	TR_VANILLA,
+	// u8 HookId, u32 data, u32 me, u32 target, u8 wordswap, u8 result, u32 ns
+	TR_CALL
+};
+
+static const uint32_t TRACE_VERSION = 1;
+// character and data id for nullptr
+static const uint32_t TRACE_NONE = 0;
+
+extern bool traceEnabled;
+
+// returns false if the file can't be opened
+bool startTrace(const char* path);
+// writes the current variable values, called after a load
+void traceVariables();
+
+// start a call, records are kept until traceResult
+void traceCheckConditions(DialogLineData* line, Character* me, Character* target, bool isWordswap);
+void traceCheckTags(DialogLineData* line, Character* me, Character* target);
+void traceIsTrue(GameData* stateData);
+void traceDoActions(Dialogue* dialog, DialogLineData* line);
+// ends the call, result is ignored for _doActions
+void traceResult(bool result);
+
+void recordVanilla(bool result);
+
+// passes the result of a vanilla function through
+inline bool traceVanilla(bool result)
+{
+	if (traceEnabled)
+		recordVanilla(result);
+	return result;
+}
@@ -0,0 +1,242 @@
+#include "VariablePredicates.h"
+#include "VariableStore.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+// x64 always has SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VARIABLE_PREDICATES_SSE2
+#include <emmintrin.h>
+#endif
+
+VariablePredicates variablePredicates;
+
+namespace
+{
+	const uint32_t WORD_BITS = 32;
+	// batches with at least this many bitmap words are split across workerPool
+	const size_t PARALLEL_WORDS = 256;
+	const size_t PARALLEL_GRAIN = 64;
+
+	bool evaluateLane(int32_t variable, int32_t present, int32_t value, int32_t equal, int32_t less, int32_t more, int32_t missing)
+	{
+		return ((variable == value) & (equal != 0))
+			| ((variable < value) & (less != 0))
+			| ((variable > value) & (more != 0))
+			| ((present == 0) & (missing != 0));
+	}
+
+	// bits for the 32 predicates starting at the given pointers
+	uint32_t evaluateWord(const int32_t* variables, const int32_t* present, const int32_t* values,
+		const int32_t* equal, const int32_t* less, const int32_t* more, const int32_t* missing)
+	{
+		uint32_t bits = 0;
+#ifdef VARIABLE_PREDICATES_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for (uint32_t i = 0; i < WORD_BITS; i += 4)
+		{
+			const __m128i variable = _mm_loadu_si128((const __m128i*)(variables + i));
+			const __m128i value = _mm_loadu_si128((const __m128i*)(values + i));
+			__m128i pass = _mm_and_si128(_mm_cmpeq_epi32(variable, value), _mm_loadu_si128((const __m128i*)(equal + i)));
+			pass = _mm_or_si128(pass, _mm_and_si128(_mm_cmplt_epi32(variable, value), _mm_loadu_si128((const __m128i*)(less + i))));
+			pass = _mm_or_si128(pass, _mm_and_si128(_mm_cmpgt_epi32(variable, value), _mm_loadu_si128((const __m128i*)(more + i))));
+			const __m128i isMissing = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(present + i)), zero);
+			pass = _mm_or_si128(pass, _mm_and_si128(isMissing, _mm_loadu_si128((const __m128i*)(missing + i))));
+			// sign bit of each lane
+			bits |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(pass)) << i;
+		}
+#else
+		for (uint32_t i = 0; i < WORD_BITS; ++i)
+		{
+			if (evaluateLane(variables[i], present[i], values[i], equal[i], less[i], more[i], missing[i]))
+				bits |= 1u << i;
+		}
+#endif
+		return bits;
+	}
+}
+
+size_t hash_value(const VariablePredicates::Key& key)
+{
+	size_t seed = 0;
+	boost::hash_combine(seed, key.slot);
+	boost::hash_combine(seed, key.compareBy);
+	boost::hash_combine(seed, key.value);
+	boost::hash_combine(seed, key.passIfMissing);
+	return seed;
+}
+
+VariablePredicates::Bitmap::Bitmap(uint32_t capacity)
+	: capacity(capacity), words(new boost::atomic<uint32_t>[capacity / WORD_BITS]), evaluatedVersion(0)
+{
+	for (uint32_t i = 0; i < capacity / WORD_BITS; ++i)
+		words[i].store(0, boost::memory_order_relaxed);
+}
+
+VariablePredicates::Bitmap::~Bitmap()
+{
+	delete[] words;
+}
+
+VariablePredicates::VariablePredicates()
+	: count(0), bitmap(new Bitmap(1024))
+{
+}
+
+VariablePredicates::~VariablePredicates()
+{
+	delete bitmap.load(boost::memory_order_acquire);
+	for (size_t i = 0; i < retired.size(); ++i)
+		delete retired[i];
+}
+
+void VariablePredicates::releaseRetired()
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+	for (size_t i = 0; i < retired.size(); ++i)
+		delete retired[i];
+	retired.clear();
+}
+
+int VariablePredicates::add(int slot, ComparisonEnum compareBy, int32_t value, bool passIfMissing)
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+
+	Key key;
+	key.slot = slot;
+	key.compareBy = (int32_t)compareBy;
+	key.value = value;
+	key.passIfMissing = passIfMissing;
+	boost::unordered_map<Key, int>::iterator iter = indices.find(key);
+	if (iter != indices.end())
+		return iter->second;
+
+	const int predicate = count++;
+	indices.emplace(key, predicate);
+
+	// grow a whole word at a time, new lanes never pass until they're filled in
+	if ((uint32_t)predicate >= slots.size())
+	{
+		const size_t padded = slots.size() + WORD_BITS;
+		slots.resize(padded, 0);
+		values.resize(padded, 0);
+		equalMask.resize(padded, 0);
+		lessMask.resize(padded, 0);
+		moreMask.resize(padded, 0);
+		missingMask.resize(padded, 0);
+		variableValues.resize(padded, 0);
+		variablePresent.resize(padded, 1);
+	}
+	slots[predicate] = slot;
+	values[predicate] = value;
+	equalMask[predicate] = compareBy == ComparisonEnum::CE_EQUALS ? -1 : 0;
+	lessMask[predicate] = compareBy == ComparisonEnum::CE_LESS_THAN ? -1 : 0;
+	moreMask[predicate] = compareBy == ComparisonEnum::CE_MORE_THAN ? -1 : 0;
+	missingMask[predicate] = passIfMissing ? -1 : 0;
+
+	Bitmap* current = bitmap.load(boost::memory_order_relaxed);
+	if ((uint32_t)predicate >= current->capacity)
+	{
+		Bitmap* replacement = new Bitmap(current->capacity * 2);
+		for (uint32_t i = 0; i < current->capacity / WORD_BITS; ++i)
+			replacement->words[i].store(current->words[i].load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+		replacement->evaluatedVersion.store(current->evaluatedVersion.load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+		bitmap.store(replacement, boost::memory_order_release);
+		retired.push_back(current);
+		current = replacement;
+	}
+
+	// the rest of the bitmap stays valid, anything stale is re-evaluated when the version changes
+	if (current->evaluatedVersion.load(boost::memory_order_relaxed) != 0)
+		evaluatePredicate(predicate, current);
+
+	return predicate;
+}
+
+bool VariablePredicates::allPassed(const int* predicateList, int listCount)
+{
+	while (true)
+	{
+		// version is read before the values are gathered so a concurrent write always invalidates the bits
+		const uint32_t version = variableStore.getVersion();
+		const Bitmap* current = bitmap.load(boost::memory_order_acquire);
+		if (current->evaluatedVersion.load(boost::memory_order_acquire) != version)
+		{
+			boost::lock_guard<boost::mutex> guard(lock);
+			evaluate(version);
+			continue;
+		}
+
+		bool result = true;
+		for (int i = 0; i < listCount; ++i)
+		{
+			const uint32_t predicate = (uint32_t)predicateList[i];
+			if (!((current->words[predicate / WORD_BITS].load(boost::memory_order_relaxed) >> (predicate % WORD_BITS)) & 1))
+			{
+				result = false;
+				break;
+			}
+		}
+
+		// bits were rewritten while reading
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		if (current->evaluatedVersion.load(boost::memory_order_relaxed) == version)
+			return result;
+	}
+}
+
+void VariablePredicates::evaluate(uint32_t version)
+{
+	Bitmap* current = bitmap.load(boost::memory_order_relaxed);
+	// another reader got here first
+	if (current->evaluatedVersion.load(boost::memory_order_relaxed) == version)
+		return;
+
+	current->evaluatedVersion.store(0, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+	const size_t wordCount = slots.size() / WORD_BITS;
+	if (wordCount < PARALLEL_WORDS)
+		evaluateWords(0, wordCount, current);
+	else
+		workerPool.any(wordCount, PARALLEL_GRAIN, [&](size_t begin, size_t end) -> bool
+		{
+			evaluateWords(begin, end, current);
+			return false;
+		});
+	current->evaluatedVersion.store(version, boost::memory_order_release);
+}
+
+void VariablePredicates::evaluateWords(size_t begin, size_t end, Bitmap* target)
+{
+	// padding lanes keep their scratch values
+	const size_t first = begin * WORD_BITS;
+	const size_t last = std::min(end * WORD_BITS, (size_t)count);
+	if (last > first)
+		variableStore.gather(&slots[first], (int)(last - first), &variableValues[first], &variablePresent[first]);
+
+	for (size_t word = begin; word < end; ++word)
+	{
+		const size_t lane = word * WORD_BITS;
+		const uint32_t bits = evaluateWord(&variableValues[lane], &variablePresent[lane], &values[lane],
+			&equalMask[lane], &lessMask[lane], &moreMask[lane], &missingMask[lane]);
+		target->words[word].store(bits, boost::memory_order_relaxed);
+	}
+}
+
+void VariablePredicates::evaluatePredicate(int predicate, Bitmap* target)
+{
+	variableStore.gather(&slots[predicate], 1, &variableValues[predicate], &variablePresent[predicate]);
+	const bool pass = evaluateLane(variableValues[predicate], variablePresent[predicate], values[predicate],
+		equalMask[predicate], lessMask[predicate], moreMask[predicate], missingMask[predicate]);
+
+	const uint32_t version = target->evaluatedVersion.load(boost::memory_order_relaxed);
+	target->evaluatedVersion.store(0, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+	boost::atomic<uint32_t>& word = target->words[predicate / WORD_BITS];
+	const uint32_t bit = 1u << (predicate % WORD_BITS);
+	word.store(pass ? (word.load(boost::memory_order_relaxed) | bit) : (word.load(boost::memory_order_relaxed) & ~bit), boost::memory_order_relaxed);
+	target->evaluatedVersion.store(version, boost::memory_order_release);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <kenshi/Dialogue.h>
+
+// Every (variable, comparison, constant) check used by dialogue lines and world states, evaluated together
+// Predicates are deduplicated and stored as structure of arrays. When the VariableStore version changes the first
+// reader re-evaluates all of them with SSE2, four per instruction, into a pass bitmap. Individual checks then read
+// their bit. Predicates live until the plugin is unloaded, lines compiled after a load reuse their old indices.
+class VariablePredicates
+{
+public:
+	VariablePredicates();
+	~VariablePredicates();
+
+	// returns the predicate's index, adding it if needed
+	// passIfMissing makes the predicate pass while the variable has no value
+	int add(int slot, ComparisonEnum compareBy, int32_t value, bool passIfMissing);
+
+	bool passed(int predicate)
+	{
+		return allPassed(&predicate, 1);
+	}
+	// true if every listed predicate passes, the bitmap is read once
+	bool allPassed(const int* predicateList, int count);
+
+	int size() const { return count; }
+
+	// frees bitmaps replaced by growth, call when nothing can be evaluating, like a load
+	void releaseRetired();
+
+private:
+	VariablePredicates(const VariablePredicates&);
+	VariablePredicates& operator=(const VariablePredicates&);
+
+	struct Key
+	{
+		int32_t slot;
+		int32_t compareBy;
+		int32_t value;
+		bool passIfMissing;
+
+		bool operator==(const Key& other) const
+		{
+			return slot == other.slot && compareBy == other.compareBy && value == other.value && passIfMissing == other.passIfMissing;
+		}
+	};
+	friend size_t hash_value(const Key& key);
+
+	struct Bitmap
+	{
+		uint32_t capacity;
+		boost::atomic<uint32_t>* words;
+		// VariableStore version the bits were evaluated at, 0 while they're being written
+		boost::atomic<uint32_t> evaluatedVersion;
+
+		Bitmap(uint32_t capacity);
+		~Bitmap();
+	};
+
+	// lock must be held
+	void evaluate(uint32_t version);
+	// gathers and evaluates [begin, end) bitmap words, large batches are split across workerPool
+	void evaluateWords(size_t begin, size_t end, Bitmap* target);
+	void evaluatePredicate(int predicate, Bitmap* target);
+
+	boost::mutex lock;
+	boost::unordered_map<Key, int> indices;
+	int count;
+
+	// structure of arrays, padded to a whole bitmap word with predicates that never pass
+	std::vector<int32_t> slots;
+	std::vector<int32_t> values;
+	// all bits set where the predicate passes on that comparison
+	std::vector<int32_t> equalMask;
+	std::vector<int32_t> lessMask;
+	std::vector<int32_t> moreMask;
+	std::vector<int32_t> missingMask;
+	// scratch for the gathered variables
+	std::vector<int32_t> variableValues;
+	std::vector<int32_t> variablePresent;
+
+	boost::atomic<Bitmap*> bitmap;
+	// bitmaps replaced by growth, kept after the new one is published because readers may still be using them,
+	// and only freed by releaseRetired at the next load
+	// growth doubles so this never holds more than the current bitmap
+	std::vector<Bitmap*> retired;
+};
+
+extern VariablePredicates variablePredicates;
@@ -0,0 +1,155 @@
+#include "VariableSidecar.h"
+
+#include <cstring>
+
+namespace VariableSidecar
+{
+	static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	static uint32_t checksum(const uint8_t* data, size_t size)
+	{
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= data[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	static std::string toBase64(const std::vector<uint8_t>& data)
+	{
+		std::string out;
+		out.reserve((data.size() + 2) / 3 * 4);
+		for (size_t i = 0; i < data.size(); i += 3)
+		{
+			uint32_t chunk = (uint32_t)data[i] << 16;
+			if (i + 1 < data.size())
+				chunk |= (uint32_t)data[i + 1] << 8;
+			if (i + 2 < data.size())
+				chunk |= data[i + 2];
+
+			out.push_back(base64Chars[(chunk >> 18) & 63]);
+			out.push_back(base64Chars[(chunk >> 12) & 63]);
+			out.push_back(i + 1 < data.size() ? base64Chars[(chunk >> 6) & 63] : '=');
+			out.push_back(i + 2 < data.size() ? base64Chars[chunk & 63] : '=');
+		}
+		return out;
+	}
+
+	static bool fromBase64(const std::string& encoded, std::vector<uint8_t>& out)
+	{
+		if (encoded.size() % 4 != 0)
+			return false;
+
+		int lookup[256];
+		for (int i = 0; i < 256; ++i)
+			lookup[i] = -1;
+		for (int i = 0; i < 64; ++i)
+			lookup[(uint8_t)base64Chars[i]] = i;
+
+		out.clear();
+		out.reserve(encoded.size() / 4 * 3);
+		for (size_t i = 0; i < encoded.size(); i += 4)
+		{
+			uint32_t chunk = 0;
+			int padding = 0;
+			for (int j = 0; j < 4; ++j)
+			{
+				const uint8_t c = encoded[i + j];
+				if (c == '=' && j >= 2 && i + 4 == encoded.size())
+				{
+					++padding;
+					chunk <<= 6;
+					continue;
+				}
+				if (lookup[c] < 0 || padding)
+					return false;
+				chunk = (chunk << 6) | lookup[c];
+			}
+
+			out.push_back((chunk >> 16) & 0xFF);
+			if (padding < 2)
+				out.push_back((chunk >> 8) & 0xFF);
+			if (padding < 1)
+				out.push_back(chunk & 0xFF);
+		}
+		return true;
+	}
+
+	uint64_t hashStringID(const std::string& stringID)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < stringID.size(); ++i)
+		{
+			hash ^= (uint8_t)stringID[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	std::string encode(const std::vector<Entry>& entries)
+	{
+		uint32_t stringBytes = 0;
+		for (size_t i = 0; i < entries.size(); ++i)
+			stringBytes += (uint32_t)entries[i].stringID->size() + 1;
+
+		std::vector<uint8_t> buffer(sizeof(Header) + entries.size() * sizeof(Record) + stringBytes);
+		Header* header = (Header*)&buffer[0];
+		Record* records = (Record*)(&buffer[0] + sizeof(Header));
+		char* strings = (char*)(records + entries.size());
+
+		header->magic = MAGIC;
+		header->version = VERSION;
+		header->headerSize = sizeof(Header);
+		header->count = (uint32_t)entries.size();
+		header->stringBytes = stringBytes;
+
+		uint32_t stringOffset = 0;
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			records[i].hash = entries[i].hash;
+			records[i].stringOffset = stringOffset;
+			records[i].value = entries[i].value;
+
+			memcpy(strings + stringOffset, entries[i].stringID->c_str(), entries[i].stringID->size() + 1);
+			stringOffset += (uint32_t)entries[i].stringID->size() + 1;
+		}
+
+		header->checksum = checksum(&buffer[0] + sizeof(Header), buffer.size() - sizeof(Header));
+		return toBase64(buffer);
+	}
+
+	Reader::Reader()
+		: header(nullptr), records(nullptr), strings(nullptr)
+	{
+	}
+
+	bool Reader::open(const std::string& encoded)
+	{
+		if (!fromBase64(encoded, buffer) || buffer.size() < sizeof(Header))
+			return false;
+
+		header = (const Header*)&buffer[0];
+		if (header->magic != MAGIC || header->version != VERSION || header->headerSize != sizeof(Header))
+			return false;
+
+		const size_t expectedSize = sizeof(Header) + (size_t)header->count * sizeof(Record) + header->stringBytes;
+		if (buffer.size() != expectedSize)
+			return false;
+		if (checksum(&buffer[0] + sizeof(Header), buffer.size() - sizeof(Header)) != header->checksum)
+			return false;
+
+		records = (const Record*)(&buffer[0] + sizeof(Header));
+		strings = (const char*)(records + header->count);
+
+		// every string must be in bounds and terminated
+		if (header->stringBytes > 0 && strings[header->stringBytes - 1] != '\0')
+			return false;
+		for (uint32_t i = 0; i < header->count; ++i)
+			if (records[i].stringOffset >= header->stringBytes)
+				return false;
+
+		return true;
+	}
+}
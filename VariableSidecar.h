@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Compact binary encoding of world state variables for saves
+// Only variables that differ from their mod defaults are stored, as fixed size records in no particular order:
+//   Header
+//   Record[count]          read in order on load, the hash finds the slot without hashing the string
+//   char strings[]         NUL terminated stringIDs, Record::stringOffset indexes this
+// The blob is base64 encoded so it can be stored in a single GameData string in the save
+namespace VariableSidecar
+{
+	static const uint32_t MAGIC = 0x53564642; // "BFVS"
+	static const uint16_t VERSION = 1;
+
+	// stringID of the save record holding the sidecar
+	static const char* const RECORD_STRING_ID = "BFrizzExtraExtensions-variables";
+	// sdata key of the encoded sidecar
+	static const char* const RECORD_FIELD = "data";
+
+#pragma pack(push, 1)
+	struct Header
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t headerSize;
+		uint32_t count;
+		uint32_t stringBytes;
+		// FNV-1a of the records and strings
+		uint32_t checksum;
+	};
+
+	struct Record
+	{
+		uint64_t hash;
+		uint32_t stringOffset;
+		int32_t value;
+	};
+#pragma pack(pop)
+
+	// FNV-1a, also used by VariableStore to find slots without hashing strings on load
+	uint64_t hashStringID(const std::string& stringID);
+
+	struct Entry
+	{
+		uint64_t hash;
+		const std::string* stringID;
+		int32_t value;
+	};
+
+	std::string encode(const std::vector<Entry>& entries);
+
+	// validated view of a decoded sidecar
+	class Reader
+	{
+	public:
+		Reader();
+
+		// false if the data is corrupt or from an unknown version
+		bool open(const std::string& encoded);
+
+		uint32_t size() const { return header->count; }
+		uint64_t hash(uint32_t i) const { return records[i].hash; }
+		const char* stringID(uint32_t i) const { return strings + records[i].stringOffset; }
+		int32_t value(uint32_t i) const { return records[i].value; }
+
+	private:
+		std::vector<uint8_t> buffer;
+		const Header* header;
+		const Record* records;
+		const char* strings;
+	};
+}
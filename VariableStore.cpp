@@ -0,0 +1,326 @@
+#include "VariableStore.h"
+#include "VariableSidecar.h"
+
+#include <cstring>
+#include <Debug.h>
+#include <kenshi/GameData.h>
+#include <kenshi/GameWorld.h>
+#include <kenshi/Globals.h>
+#include <boost/thread/lock_guard.hpp>
+
+VariableStore variableStore;
+
+VariableStore::Storage::Storage(uint32_t capacity)
+	: capacity(capacity), values(new int32_t[capacity]), defaults(new int32_t[capacity]), present(new uint8_t[capacity])
+{
+	memset(values, 0, capacity * sizeof(int32_t));
+	memset(defaults, 0, capacity * sizeof(int32_t));
+	memset(present, 0, capacity * sizeof(uint8_t));
+}
+
+VariableStore::Storage::~Storage()
+{
+	delete[] values;
+	delete[] defaults;
+	delete[] present;
+}
+
+VariableStore::VariableStore()
+	: compactSaves(false), version(1), storage(new Storage(64))
+{
+}
+
+VariableStore::~VariableStore()
+{
+	delete storage.load(boost::memory_order_acquire);
+	for (size_t i = 0; i < retired.size(); ++i)
+		delete retired[i];
+}
+
+void VariableStore::rebuildRegistry(std::vector<GameData*>* lines, std::vector<GameData*>* worldStates)
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+
+	std::vector<uint8_t> found(variables.size(), 0);
+	ogre_unordered_map<std::string, GameData*>::type::iterator iter = ou->gamedata.gamedataSID.begin();
+	for (; iter != ou->gamedata.gamedataSID.end(); ++iter)
+	{
+		if (lines && iter->second->type == DIALOGUE_LINE)
+			lines->push_back(iter->second);
+		else if (worldStates && iter->second->type == WORLD_EVENT_STATE)
+			worldStates->push_back(iter->second);
+		if (iter->second->type != (itemType)VARIABLE)
+			continue;
+		const int slot = registerVariable(iter->second);
+		if ((size_t)slot < found.size())
+			found[slot] = 1;
+	}
+
+	for (size_t slot = 0; slot < found.size(); ++slot)
+	{
+		if (!found[slot] && variables[slot])
+			dropVariable((int)slot);
+	}
+
+	// stringIDs may have changed
+	slotsByHash.clear();
+	for (size_t slot = 0; slot < variables.size(); ++slot)
+	{
+		if (!variables[slot])
+			continue;
+		stringIDs[slot] = variables[slot]->stringID;
+		slotsByHash.emplace(VariableSidecar::hashStringID(stringIDs[slot]), (int)slot);
+	}
+}
+
+void VariableStore::dropVariable(int slot)
+{
+	// the pointer may be reused by a new record, which then gets its own slot
+	slots.erase(variables[slot]);
+	boost::unordered_map<uint64_t, int>::iterator hashIter = slotsByHash.find(VariableSidecar::hashStringID(stringIDs[slot]));
+	if (hashIter != slotsByHash.end() && hashIter->second == slot)
+		slotsByHash.erase(hashIter);
+	variables[slot] = nullptr;
+	storage.load(boost::memory_order_relaxed)->present[slot] = 0;
+}
+
+int VariableStore::getSlot(GameData* variable)
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+	return registerVariable(variable);
+}
+
+void VariableStore::getVariables(std::vector<GameData*>& out)
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+	out = variables;
+}
+
+int VariableStore::registerVariable(GameData* variable)
+{
+	boost::unordered_map<GameData*, int>::iterator iter = slots.find(variable);
+	if (iter != slots.end())
+		return iter->second;
+
+	const int slot = (int)variables.size();
+	variables.push_back(variable);
+	stringIDs.push_back(variable->stringID);
+	slots.emplace(variable, slot);
+	slotsByHash.emplace(VariableSidecar::hashStringID(variable->stringID), slot);
+	isModified.push_back(0);
+
+	Storage* current = storage.load(boost::memory_order_relaxed);
+	if ((uint32_t)slot >= current->capacity)
+	{
+		Storage* replacement = new Storage(current->capacity * 2);
+		memcpy(replacement->values, current->values, current->capacity * sizeof(int32_t));
+		memcpy(replacement->defaults, current->defaults, current->capacity * sizeof(int32_t));
+		memcpy(replacement->present, current->present, current->capacity * sizeof(uint8_t));
+		storage.store(replacement, boost::memory_order_release);
+		retired.push_back(current);
+		current = replacement;
+	}
+
+	readValue(slot);
+	current->defaults[slot] = current->values[slot];
+	return slot;
+}
+
+void VariableStore::readValue(int slot)
+{
+	Storage* current = storage.load(boost::memory_order_relaxed);
+	ogre_unordered_map<std::string, int>::type::iterator valueIter = variables[slot]->idata.find("value");
+	if (valueIter != variables[slot]->idata.end())
+	{
+		current->values[slot] = valueIter->second;
+		current->present[slot] = 1;
+	}
+	else
+	{
+		current->values[slot] = 0;
+		current->present[slot] = 0;
+	}
+}
+
+void VariableStore::markModified(int slot)
+{
+	if (!isModified[slot])
+	{
+		isModified[slot] = 1;
+		modified.push_back(slot);
+	}
+}
+
+void VariableStore::bumpVersion()
+{
+	// skip 0 so it can mean "no cached result"
+	if (version.fetch_add(1, boost::memory_order_release) + 1 == 0)
+		version.fetch_add(1, boost::memory_order_release);
+}
+
+void VariableStore::gather(const int32_t* slotList, int count, int32_t* valuesOut, int32_t* presentOut) const
+{
+	const Storage* current = storage.load(boost::memory_order_acquire);
+	for (int i = 0; i < count; ++i)
+	{
+		valuesOut[i] = current->values[slotList[i]];
+		presentOut[i] = current->present[slotList[i]];
+	}
+}
+
+void VariableStore::set(int slot, int32_t value)
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+	storage.load(boost::memory_order_relaxed)->values[slot] = value;
+	markModified(slot);
+	bumpVersion();
+}
+
+void VariableStore::add(int slot, int32_t value)
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+	storage.load(boost::memory_order_relaxed)->values[slot] += value;
+	markModified(slot);
+	bumpVersion();
+}
+
+void VariableStore::saveTo(GameDataContainer* container)
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+
+	Storage* current = storage.load(boost::memory_order_relaxed);
+	std::vector<VariableSidecar::Entry> entries;
+	size_t kept = 0;
+	for (size_t i = 0; i < modified.size(); ++i)
+	{
+		const int slot = modified[i];
+
+		// the record may have been removed or renamed since the last load, without touching it
+		if (variables[slot])
+		{
+			ogre_unordered_map<std::string, GameData*>::type::iterator iter = ou->gamedata.gamedataSID.find(stringIDs[slot]);
+			if (iter == ou->gamedata.gamedataSID.end() || iter->second != variables[slot])
+				dropVariable(slot);
+		}
+		GameData* variable = variables[slot];
+		if (!variable)
+		{
+			isModified[slot] = 0;
+			continue;
+		}
+
+		// keep idata in sync at save boundaries
+		if (current->present[slot])
+			variable->idata["value"] = current->values[slot];
+
+		// back to its default, nothing to save
+		if (current->values[slot] == current->defaults[slot])
+		{
+			isModified[slot] = 0;
+			continue;
+		}
+		modified[kept++] = slot;
+
+		if (compactSaves)
+		{
+			VariableSidecar::Entry entry;
+			entry.hash = VariableSidecar::hashStringID(variable->stringID);
+			entry.stringID = &variable->stringID;
+			entry.value = current->values[slot];
+			entries.push_back(entry);
+		}
+		else
+		{
+			// create new GameData in save
+			GameData* saved = container->createNewData(variable->type, variable->stringID, variable->name);
+			if (saved)
+				saved->updateFrom(variable, false);
+		}
+	}
+	modified.resize(kept);
+
+	if (compactSaves)
+	{
+		GameData* saved = container->createNewData((itemType)VARIABLE, VariableSidecar::RECORD_STRING_ID, "BFrizz Extra Extensions variables");
+		if (saved)
+			saved->sdata[VariableSidecar::RECORD_FIELD] = VariableSidecar::encode(entries);
+		else
+			ErrorLog("WorldStates: Could not save variables");
+	}
+}
+
+bool VariableStore::loadSidecar()
+{
+	ogre_unordered_map<std::string, GameData*>::type::iterator iter = ou->savedata.gamedataSID.find(VariableSidecar::RECORD_STRING_ID);
+	if (iter == ou->savedata.gamedataSID.end())
+		return false;
+
+	ogre_unordered_map<std::string, std::string>::type::iterator dataIter = iter->second->sdata.find(VariableSidecar::RECORD_FIELD);
+	VariableSidecar::Reader reader;
+	if (dataIter == iter->second->sdata.end() || !reader.open(dataIter->second))
+	{
+		ErrorLog("WorldStates: Saved variables are corrupt");
+		return false;
+	}
+
+	Storage* current = storage.load(boost::memory_order_relaxed);
+	for (uint32_t i = 0; i < reader.size(); ++i)
+	{
+		// variables from mods that are no longer loaded are dropped
+		boost::unordered_map<uint64_t, int>::iterator slotIter = slotsByHash.find(reader.hash(i));
+		if (slotIter == slotsByHash.end())
+			continue;
+
+		const int slot = slotIter->second;
+		if (!current->present[slot] || variables[slot]->stringID != reader.stringID(i))
+			continue;
+
+		current->values[slot] = reader.value(i);
+		variables[slot]->idata["value"] = reader.value(i);
+		markModified(slot);
+	}
+	return true;
+}
+
+void VariableStore::loadFromSave()
+{
+	boost::lock_guard<boost::mutex> guard(lock);
+
+	Storage* current = storage.load(boost::memory_order_relaxed);
+
+	// values from the previous game, variables missing from the save use their defaults
+	for (size_t i = 0; i < modified.size(); ++i)
+	{
+		const int slot = modified[i];
+		current->values[slot] = current->defaults[slot];
+		if (current->present[slot] && variables[slot])
+			variables[slot]->idata["value"] = current->defaults[slot];
+		isModified[slot] = 0;
+	}
+	modified.clear();
+
+	// older saves and saves without compactSaves have a GameData record per variable
+	if (!loadSidecar())
+	{
+		for (int slot = 0; slot < (int)variables.size(); ++slot)
+		{
+			if (!variables[slot])
+				continue;
+			ogre_unordered_map<std::string, GameData*>::type::iterator iter = ou->savedata.gamedataSID.find(variables[slot]->stringID);
+			if (iter == ou->savedata.gamedataSID.end() || iter->second->type != (itemType)VARIABLE)
+				continue;
+
+			ou->gamedata.updateData(iter->second, false);
+			readValue(slot);
+			if (current->values[slot] != current->defaults[slot])
+				markModified(slot);
+		}
+	}
+
+	bumpVersion();
+
+	// nothing is evaluating while a save loads
+	for (size_t i = 0; i < retired.size(); ++i)
+		delete retired[i];
+	retired.clear();
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
+class GameData;
+class GameDataContainer;
+
+enum itemTypeExtended
+{
+	VARIABLE = 1000
+};
+
+// World state variables are given dense slots so conditions and effects index one contiguous array
+// instead of hashing idata["value"]. idata is only kept in sync at save/load boundaries.
+// Reads are lock-free, writes and slot registration are serialised.
+// The store also acts as the registry of VARIABLE records. Saving only touches variables that differ from their mod
+// defaults, loading scans game data once for variables that were added or removed.
+// With compact saves enabled those variables are saved as a single VariableSidecar record instead of a GameData
+// record per variable, which older versions and other tools can't read. Both kinds of save are loaded either way.
+class VariableStore
+{
+public:
+	VariableStore();
+	~VariableStore();
+
+	// scans ou->gamedata for VARIABLE records, call at load
+	// records that are gone keep their slot but are no longer saved or loaded, stringIDs are re-read
+	// the same scan can collect dialogue lines and world states, for the precompile pass after a load
+	void rebuildRegistry(std::vector<GameData*>* lines = nullptr, std::vector<GameData*>* worldStates = nullptr);
+	// returns the variable's slot, registering it if needed, so variables created between rebuilds are picked up here
+	int getSlot(GameData* variable);
+	// copies the registered variables, indexed by slot, nullptr for variables that are gone
+	void getVariables(std::vector<GameData*>& out);
+
+	// false if the variable has no "value" field
+	bool hasValue(int slot) const
+	{
+		return storage.load(boost::memory_order_acquire)->present[slot] != 0;
+	}
+	int32_t get(int slot) const
+	{
+		return storage.load(boost::memory_order_acquire)->values[slot];
+	}
+	// copies values and presence for a list of slots, present is 1 or 0
+	void gather(const int32_t* slotList, int count, int32_t* valuesOut, int32_t* presentOut) const;
+	void set(int slot, int32_t value);
+	void add(int slot, int32_t value);
+
+	// changes whenever any value does, results derived from variables can be reused while this is unchanged
+	// never 0
+	uint32_t getVersion() const
+	{
+		return version.load(boost::memory_order_acquire);
+	}
+
+	// true to save a single VariableSidecar record, off by default so saves stay readable by older versions
+	void setCompactSaves(bool enabled) { compactSaves = enabled; }
+
+	// writes every variable that differs from its default to the save
+	void saveTo(GameDataContainer* container);
+	// resets variables to their defaults then copies saved values over from ou->savedata
+	void loadFromSave();
+
+private:
+	struct Storage
+	{
+		uint32_t capacity;
+		int32_t* values;
+		// value when the variable was registered, before any save was applied
+		int32_t* defaults;
+		uint8_t* present;
+
+		Storage(uint32_t capacity);
+		~Storage();
+	};
+
+	// lock must be held
+	int registerVariable(GameData* variable);
+	// the record is gone, the slot is kept but never saved or loaded again
+	void dropVariable(int slot);
+	void readValue(int slot);
+	void markModified(int slot);
+	void bumpVersion();
+	// returns false if the save has no usable sidecar
+	bool loadSidecar();
+
+	boost::mutex lock;
+	boost::unordered_map<GameData*, int> slots;
+	// by VariableSidecar::hashStringID
+	boost::unordered_map<uint64_t, int> slotsByHash;
+	// nullptr once the record is gone
+	std::vector<GameData*> variables;
+	// stringID when registered or last rebuilt, a modified variable is checked against it before it's saved
+	std::vector<std::string> stringIDs;
+
+	// slots that may differ from their default, values written back to the default are pruned on save
+	std::vector<int> modified;
+	std::vector<uint8_t> isModified;
+
+	bool compactSaves;
+
+	boost::atomic<uint32_t> version;
+	boost::atomic<Storage*> storage;
+	// storage replaced by growth, readers may still be using it until the next load
+	std::vector<Storage*> retired;
+};
+
+extern VariableStore variableStore;
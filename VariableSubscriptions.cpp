@@ -0,0 +1,255 @@
+#include "VariableSubscriptions.h"
+#include "ConditionRegistry.h"
+#include "VariableStore.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+
+namespace
+{
+	enum SubscriptionKind
+	{
+		SK_VARIABLE,
+		SK_THRESHOLD,
+		SK_DEPENDENT
+	};
+
+	struct Subscription
+	{
+		SubscriptionKind kind;
+		// variable slot, -1 for dependent subscriptions
+		int slot;
+		// line or world state for dependent subscriptions
+		GameData* dependent;
+		// comparisonIndex, for threshold subscriptions
+		int comparison;
+		int threshold;
+		VariableEventCallback callback;
+		void* context;
+		// without a callback
+		std::deque<VariableEvent> queue;
+	};
+
+	struct PendingCallback
+	{
+		VariableEventCallback callback;
+		void* context;
+		VariableEvent event;
+	};
+
+	// everything below is guarded by subscriptionsLock
+	boost::mutex subscriptionsLock;
+	// by id - 1, nullptr once removed, ids aren't reused
+	std::vector<Subscription*> subscriptions;
+	// variable and threshold subscription ids by slot
+	std::vector<std::vector<int> > slotSubscriptions;
+	// dependent subscription ids by line or world state
+	boost::unordered_map<GameData*, std::vector<int> > dependentSubscriptions;
+	// reverse index, the lines and world states compiled with each slot since the last load
+	// a set as a line can read a variable more than once, and a popular variable has many dependents
+	std::vector<boost::unordered_set<GameData*> > slotDependents;
+
+	// changes cost a load while nothing is subscribed
+	boost::atomic<uint32_t> subscriptionCount(0);
+
+	bool passesThreshold(int comparison, int32_t value, int32_t threshold)
+	{
+		switch (comparison)
+		{
+			case 0:
+				return compareValues<0>(value, threshold);
+			case 1:
+				return compareValues<1>(value, threshold);
+			default:
+				return compareValues<2>(value, threshold);
+		}
+	}
+
+	// takes ownership of subscription
+	int addSubscription(Subscription* subscription)
+	{
+		boost::lock_guard<boost::mutex> lock(subscriptionsLock);
+		subscriptions.push_back(subscription);
+		const int id = (int)subscriptions.size();
+		if (subscription->kind == SK_DEPENDENT)
+		{
+			dependentSubscriptions[subscription->dependent].push_back(id);
+		}
+		else
+		{
+			if (slotSubscriptions.size() <= (size_t)subscription->slot)
+				slotSubscriptions.resize(subscription->slot + 1);
+			slotSubscriptions[subscription->slot].push_back(id);
+		}
+		subscriptionCount.fetch_add(1, boost::memory_order_relaxed);
+		return id;
+	}
+
+	int subscribe(SubscriptionKind kind, GameData* variable, GameData* dependent, int comparison, int threshold, VariableEventCallback callback, void* context)
+	{
+		Subscription* subscription = new Subscription();
+		subscription->kind = kind;
+		subscription->slot = variable ? variableStore.getSlot(variable) : -1;
+		subscription->dependent = dependent;
+		subscription->comparison = comparison;
+		subscription->threshold = threshold;
+		subscription->callback = callback;
+		subscription->context = context;
+		return addSubscription(subscription);
+	}
+
+	// anything else would be given a slot by getSlot
+	bool isVariable(GameData* data)
+	{
+		return data && data->type == (itemType)VARIABLE;
+	}
+
+	// subscriptionsLock must be held
+	Subscription* findSubscription(int id)
+	{
+		if (id <= 0 || (size_t)id > subscriptions.size())
+			return nullptr;
+		return subscriptions[id - 1];
+	}
+
+	// subscriptionsLock must be held, callbacks are run once the lock is released
+	void deliver(int id, const VariableEvent& event, std::vector<PendingCallback>& callbacks)
+	{
+		Subscription* subscription = subscriptions[id - 1];
+		if (subscription->kind == SK_THRESHOLD
+			&& passesThreshold(subscription->comparison, event.oldValue, subscription->threshold) == passesThreshold(subscription->comparison, event.newValue, subscription->threshold))
+			return;
+
+		if (subscription->callback)
+		{
+			PendingCallback pending;
+			pending.callback = subscription->callback;
+			pending.context = subscription->context;
+			pending.event = event;
+			callbacks.push_back(pending);
+		}
+		else
+		{
+			if (subscription->queue.size() >= (size_t)MAX_QUEUED_VARIABLE_EVENTS)
+				subscription->queue.pop_front();
+			subscription->queue.push_back(event);
+		}
+	}
+}
+
+void addVariableDependent(int slot, GameData* dependent)
+{
+	boost::lock_guard<boost::mutex> lock(subscriptionsLock);
+	if (slotDependents.size() <= (size_t)slot)
+		slotDependents.resize(slot + 1);
+	slotDependents[slot].insert(dependent);
+}
+
+void clearVariableDependents()
+{
+	boost::lock_guard<boost::mutex> lock(subscriptionsLock);
+	slotDependents.clear();
+}
+
+void notifyVariableChanged(int slot, GameData* variable, int32_t oldValue, int32_t newValue)
+{
+	if (oldValue == newValue || subscriptionCount.load(boost::memory_order_relaxed) == 0)
+		return;
+
+	std::vector<PendingCallback> callbacks;
+	{
+		boost::lock_guard<boost::mutex> lock(subscriptionsLock);
+
+		VariableEvent event;
+		event.variable = variable;
+		event.dependent = nullptr;
+		event.oldValue = oldValue;
+		event.newValue = newValue;
+
+		if ((size_t)slot < slotSubscriptions.size())
+		{
+			const std::vector<int>& ids = slotSubscriptions[slot];
+			for (size_t i = 0; i < ids.size(); ++i)
+				deliver(ids[i], event, callbacks);
+		}
+
+		if ((size_t)slot < slotDependents.size() && !dependentSubscriptions.empty())
+		{
+			const boost::unordered_set<GameData*>& dependents = slotDependents[slot];
+			for (boost::unordered_set<GameData*>::const_iterator d = dependents.begin(); d != dependents.end(); ++d)
+			{
+				boost::unordered_map<GameData*, std::vector<int> >::const_iterator iter = dependentSubscriptions.find(*d);
+				if (iter == dependentSubscriptions.end())
+					continue;
+				event.dependent = *d;
+				for (size_t i = 0; i < iter->second.size(); ++i)
+					deliver(iter->second[i], event, callbacks);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < callbacks.size(); ++i)
+		callbacks[i].callback(&callbacks[i].event, callbacks[i].context);
+}
+
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_subscribeVariable(GameData* variable, VariableEventCallback callback, void* context)
+{
+	if (!isVariable(variable))
+		return -1;
+	return subscribe(SK_VARIABLE, variable, nullptr, -1, 0, callback, context);
+}
+
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_subscribeThreshold(GameData* variable, int compareBy, int threshold, VariableEventCallback callback, void* context)
+{
+	const int comparison = comparisonIndex((ComparisonEnum)compareBy);
+	if (!isVariable(variable) || comparison < 0)
+		return -1;
+	return subscribe(SK_THRESHOLD, variable, nullptr, comparison, threshold, callback, context);
+}
+
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_subscribeDependent(GameData* lineOrWorldState, VariableEventCallback callback, void* context)
+{
+	if (!lineOrWorldState)
+		return -1;
+	return subscribe(SK_DEPENDENT, nullptr, lineOrWorldState, -1, 0, callback, context);
+}
+
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_readVariableEvents(int subscription, VariableEvent* events, int maxEvents)
+{
+	boost::lock_guard<boost::mutex> lock(subscriptionsLock);
+	Subscription* found = findSubscription(subscription);
+	if (!found || !events)
+		return 0;
+
+	int count = 0;
+	while (count < maxEvents && !found->queue.empty())
+	{
+		events[count++] = found->queue.front();
+		found->queue.pop_front();
+	}
+	return count;
+}
+
+extern "C" __declspec(dllexport) bool BFrizzExtraExtensions_unsubscribe(int subscription)
+{
+	boost::lock_guard<boost::mutex> lock(subscriptionsLock);
+	Subscription* found = findSubscription(subscription);
+	if (!found)
+		return false;
+
+	std::vector<int>& ids = found->kind == SK_DEPENDENT ? dependentSubscriptions[found->dependent] : slotSubscriptions[found->slot];
+	ids.erase(std::remove(ids.begin(), ids.end(), subscription), ids.end());
+	if (found->kind == SK_DEPENDENT && ids.empty())
+		dependentSubscriptions.erase(found->dependent);
+
+	delete found;
+	subscriptions[subscription - 1] = nullptr;
+	subscriptionCount.fetch_sub(1, boost::memory_order_relaxed);
+	return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <kenshi/GameData.h>
+
+// Push notifications for world state variable changes, so other plugins don't have to poll isTrue
+// A subscription is to a variable, to a threshold on a variable, or to a dialogue line or world state, which is
+// notified when any variable its conditions read changes. The last is backed by a reverse index from each variable
+// slot to the lines and world states compiled with it, lines and world states are indexed when they're compiled and
+// the index is emptied when a save is loaded, as everything is compiled again.
+// Events are sent when a dialogue effect changes a value. Values restored by loading a save aren't sent,
+// subscribers should re-read after a load.
+// Callbacks run on the thread that applied the effect, after the change, without any of this plugin's locks held.
+// A callback may still run once after its subscription is removed.
+
+struct VariableEvent
+{
+	GameData* variable;
+	// the line or world state subscribed to, nullptr for variable and threshold subscriptions
+	GameData* dependent;
+	int32_t oldValue;
+	int32_t newValue;
+};
+
+typedef void (*VariableEventCallback)(const VariableEvent* event, void* context);
+
+// events for subscriptions without a callback are queued, the oldest are dropped past this
+static const int MAX_QUEUED_VARIABLE_EVENTS = 1024;
+
+// called when a line or world state is compiled with a variable slot
+void addVariableDependent(int slot, GameData* dependent);
+// called when a save is loaded, the loaded game data may be at reused addresses
+void clearVariableDependents();
+// called after a dialogue effect changes a variable, only sends events if the value changed
+void notifyVariableChanged(int slot, GameData* variable, int32_t oldValue, int32_t newValue);
+
+// Exported for other plugins. Subscriptions return an id, -1 on failure, like a variable that isn't a VARIABLE
+// record. A null callback queues events for BFrizzExtraExtensions_readVariableEvents instead.
+// any change of variable
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_subscribeVariable(GameData* variable, VariableEventCallback callback, void* context);
+// changes where "value compareBy threshold" goes from true to false or back, compareBy is a ComparisonEnum
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_subscribeThreshold(GameData* variable, int compareBy, int threshold, VariableEventCallback callback, void* context);
+// changes of any variable a dialogue line or world state's conditions read
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_subscribeDependent(GameData* lineOrWorldState, VariableEventCallback callback, void* context);
+// copies up to maxEvents queued events, oldest first, returns the number copied
+extern "C" __declspec(dllexport) int BFrizzExtraExtensions_readVariableEvents(int subscription, VariableEvent* events, int maxEvents);
+extern "C" __declspec(dllexport) bool BFrizzExtraExtensions_unsubscribe(int subscription);
@@ -0,0 +1,173 @@
+#include "WorkerPool.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/tss.hpp>
+
+WorkerPool workerPool;
+
+namespace
+{
+	// set on pool threads, nested calls run serially so a worker never waits on the queues
+	boost::thread_specific_ptr<int> workerIndex;
+}
+
+WorkerPool::WorkerPool()
+	: pending(0), stopping(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		boost::lock_guard<boost::mutex> guard(wakeLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i]->join();
+		delete workers[i];
+	}
+	for (size_t i = 0; i < queues.size(); ++i)
+		delete queues[i];
+}
+
+void WorkerPool::start(int workerCount)
+{
+	for (int i = 0; i < workerCount; ++i)
+		queues.push_back(new Queue());
+	for (int i = 0; i < workerCount; ++i)
+		workers.push_back(new boost::thread(boost::bind(&WorkerPool::workerMain, this, i)));
+}
+
+bool WorkerPool::any(size_t count, size_t grain, const Body& body)
+{
+	if (grain == 0)
+		grain = 1;
+
+	if (workers.empty() || count <= grain || workerIndex.get())
+	{
+		for (size_t begin = 0; begin < count; begin += grain)
+		{
+			if (body(begin, begin + grain < count ? begin + grain : count))
+				return true;
+		}
+		return false;
+	}
+
+	const size_t chunkCount = (count + grain - 1) / grain;
+	Job job;
+	job.body = &body;
+	job.remaining.store(chunkCount, boost::memory_order_relaxed);
+	job.found.store(false, boost::memory_order_relaxed);
+
+	// deal chunks out in order so each worker starts on a contiguous run
+	const size_t perQueue = (chunkCount + queues.size() - 1) / queues.size();
+	size_t begin = 0;
+	for (size_t q = 0; q < queues.size() && begin < count; ++q)
+	{
+		Queue& queue = *queues[q];
+		boost::lock_guard<boost::mutex> guard(queue.lock);
+		for (size_t i = 0; i < perQueue && begin < count; ++i, begin += grain)
+		{
+			Chunk chunk;
+			chunk.job = &job;
+			chunk.begin = begin;
+			chunk.end = begin + grain < count ? begin + grain : count;
+			queue.chunks.push_back(chunk);
+		}
+	}
+	pending.fetch_add(chunkCount, boost::memory_order_release);
+	{
+		boost::lock_guard<boost::mutex> guard(wakeLock);
+	}
+	wake.notify_all();
+
+	// help out until every chunk of this job is done, job lives on this stack
+	Chunk chunk;
+	while (job.remaining.load(boost::memory_order_acquire) != 0)
+	{
+		if (takeChunk(-1, chunk))
+			runChunk(chunk);
+		else
+			boost::this_thread::yield();
+	}
+	return job.found.load(boost::memory_order_relaxed);
+}
+
+void WorkerPool::workerMain(int index)
+{
+	workerIndex.reset(new int(index));
+
+	Chunk chunk;
+	while (true)
+	{
+		if (takeChunk(index, chunk))
+		{
+			runChunk(chunk);
+			continue;
+		}
+
+		boost::unique_lock<boost::mutex> guard(wakeLock);
+		while (!stopping && pending.load(boost::memory_order_acquire) == 0)
+			wake.wait(guard);
+		if (stopping)
+			return;
+	}
+}
+
+bool WorkerPool::takeChunk(int own, Chunk& chunk)
+{
+	if (pending.load(boost::memory_order_acquire) == 0)
+		return false;
+
+	// newest from our own queue, it's the one most likely to still be cached
+	if (own >= 0)
+	{
+		Queue& queue = *queues[own];
+		boost::lock_guard<boost::mutex> guard(queue.lock);
+		if (queue.chunks.size() > queue.front)
+		{
+			chunk = queue.chunks.back();
+			queue.chunks.pop_back();
+			if (queue.chunks.size() == queue.front)
+			{
+				queue.chunks.clear();
+				queue.front = 0;
+			}
+			pending.fetch_sub(1, boost::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	// oldest from someone else's
+	const size_t first = own >= 0 ? (size_t)own + 1 : 0;
+	for (size_t i = 0; i < queues.size(); ++i)
+	{
+		Queue& queue = *queues[(first + i) % queues.size()];
+		boost::lock_guard<boost::mutex> guard(queue.lock);
+		if (queue.chunks.size() > queue.front)
+		{
+			chunk = queue.chunks[queue.front++];
+			if (queue.chunks.size() == queue.front)
+			{
+				queue.chunks.clear();
+				queue.front = 0;
+			}
+			pending.fetch_sub(1, boost::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkerPool::runChunk(const Chunk& chunk)
+{
+	Job* job = chunk.job;
+	// a match anywhere decides the result, the rest are only counted off
+	if (!job->found.load(boost::memory_order_relaxed) && (*job->body)(chunk.begin, chunk.end))
+		job->found.store(true, boost::memory_order_relaxed);
+	// last access, the caller may return as soon as this reaches 0
+	job->remaining.fetch_sub(1, boost::memory_order_release);
+}
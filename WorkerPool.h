@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// Small work-stealing pool for splitting read-only evaluations across cores
+// A call is split into chunks that are dealt out to per-worker queues. Workers take from the back of their own
+// queue and steal from the front of the others, the calling thread steals too and returns once every chunk is done.
+// Bodies must not have side effects other than per-thread caches, results don't depend on the number of threads.
+// With no workers, or when called from a worker, everything runs serially on the calling thread.
+class WorkerPool
+{
+public:
+	// return true to stop handing out the remaining chunks
+	typedef boost::function<bool (size_t begin, size_t end)> Body;
+
+	WorkerPool();
+	~WorkerPool();
+
+	// must be called before the first run, 0 keeps everything on the calling thread
+	void start(int workerCount);
+	int size() const { return (int)workers.size(); }
+
+	// runs body over [0, count) in chunks of grain, returns true if any chunk returned true
+	// chunks after one that returned true may be skipped
+	bool any(size_t count, size_t grain, const Body& body);
+
+private:
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+
+	struct Job
+	{
+		const Body* body;
+		// chunks not yet finished or skipped
+		boost::atomic<size_t> remaining;
+		boost::atomic<bool> found;
+	};
+
+	struct Chunk
+	{
+		Job* job;
+		size_t begin;
+		size_t end;
+	};
+
+	struct Queue
+	{
+		boost::mutex lock;
+		std::vector<Chunk> chunks;
+		// index of the oldest chunk, chunks before it have been stolen
+		size_t front;
+
+		Queue() : front(0) {}
+	};
+
+	void workerMain(int index);
+	// own is the queue popped from the back, -1 for the calling thread
+	bool takeChunk(int own, Chunk& chunk);
+	static void runChunk(const Chunk& chunk);
+
+	std::vector<boost::thread*> workers;
+	std::vector<Queue*> queues;
+
+	boost::mutex wakeLock;
+	boost::condition_variable wake;
+	// chunks queued and not yet taken
+	boost::atomic<size_t> pending;
+	bool stopping;
+};
+
+extern WorkerPool workerPool;
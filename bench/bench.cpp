@@ -0,0 +1,463 @@
+// Host-side benchmark for the plugin's hooks
+// Builds the plugin sources against the stand-ins in stubs/, generates a synthetic dialogue package and reports
+// the average cost of each hook. The _orig functions are no-ops, so only the plugin's own work is measured.
+//
+//   make && ./bfrizz_bench --lines 5000 --squad 50
+//
+// Run with --help for the full list of options.
+
+#include <kenshi/StandIns.h>
+#include "../ConditionCache.h"
+#include "../HookStats.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// plugin hooks and the engine functions they forward to
+extern bool (*DialogLineData_checkConditions_orig)(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap);
+bool DialogLineData_checkConditions_hook(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap);
+extern bool (*checkTags_orig)(DialogLineData* thisptr, Character* me, Character* target);
+bool checkTags_hook(DialogLineData* thisptr, Character* me, Character* target);
+extern WorldEventStateQuery* (*getFromData_orig)(GameData* d);
+WorldEventStateQuery* getFromData_hook(GameData* d);
+extern bool (*WorldEventStateQuery_isTrue_orig)(WorldEventStateQuery* thisptr);
+bool WorldEventStateQuery_isTrue_hook(WorldEventStateQuery* thisptr);
+extern void (*_doActions_orig)(Dialogue* thisptr, DialogLineData* dialogLine);
+void _doActions_hook(Dialogue* thisptr, DialogLineData* dialogLine);
+extern void (*saveGameState_orig)(FactionManager* thisptr, GameDataContainer* container);
+void saveGameState_hook(FactionManager* thisptr, GameDataContainer* container);
+extern void (*loadAllPlatoons_orig)(GameWorld* thisptr);
+void loadAllPlatoons_hook(GameWorld* thisptr);
+extern void (*mainLoop_GPUSensitiveStuff_orig)(GameWorld* thisptr, float time);
+void mainLoop_GPUSensitiveStuff_hook(GameWorld* thisptr, float time);
+void startPlugin();
+
+// keep in sync with ExtendedDialogConditionEnum/itemTypeExtended
+enum
+{
+	DC_IS_SLEEPING = 1000,
+	DC_HAS_SHORT_TERM_TAG,
+	DC_IS_ALLY_BECAUSE_OF_DISGUISE,
+	DC_STAT_LEVEL_UNMODIFIED,
+	DC_STAT_LEVEL_MODIFIED,
+	DC_WEAPON_LEVEL,
+	DC_ARMOUR_LEVEL,
+	VARIABLE_TYPE = 1000
+};
+
+static bool checkConditionsOrig(DialogLineData*, Dialogue*, Character*, bool) { return true; }
+static bool checkTagsOrig(DialogLineData*, Character*, Character*) { return true; }
+static WorldEventStateQuery* getFromDataOrig(GameData* d) { return WorldEventStateQuery::getFromData(d); }
+static bool isTrueOrig(WorldEventStateQuery*) { return true; }
+static void doActionsOrig(Dialogue*, DialogLineData*) {}
+static void saveGameStateOrig(FactionManager*, GameDataContainer*) {}
+static void loadAllPlatoonsOrig(GameWorld*) {}
+static void mainLoopOrig(GameWorld*, float) {}
+
+struct Options
+{
+	int lines;
+	int conditions;
+	int variableConditions;
+	int variables;
+	int squad;
+	int queries;
+	int iterations;
+	int actionPercent;
+	int repeats;
+	unsigned seed;
+	const char* statsPath;
+	bool verify;
+};
+
+struct Package
+{
+	std::vector<Character*> characters;
+	ActivePlatoon platoon;
+	Dialogue dialogue;
+	std::vector<DialogLineData*> lines;
+	std::vector<WorldEventStateQuery*> queries;
+	std::vector<GameData*> items;
+};
+
+static void usage()
+{
+	printf("usage: bfrizz_bench [options]\n"
+		"  --lines N                 dialogue lines (default 2000)\n"
+		"  --conditions N            extended conditions per line (default 4)\n"
+		"  --variable-conditions N   variable conditions per line (default 3)\n"
+		"  --variables N             world state variables (default 500)\n"
+		"  --squad N                 squad members near the speaker (default 20)\n"
+		"  --queries N               world state queries (default 1000)\n"
+		"  --iterations N            passes over the package per hook (default 200)\n"
+		"  --action-percent N        lines with variable/item effects (default 25)\n"
+		"  --repeats N               times each line is checked in a row, like interjections (default 1)\n"
+		"  --seed N                  random seed (default 1)\n"
+		"  --stats PATH              enable hook stats and write them to PATH\n"
+		"  --verify                  re-evaluate cached condition results and log stale ones\n");
+}
+
+static bool parseOptions(int argc, char** argv, Options& options)
+{
+	options.lines = 2000;
+	options.conditions = 4;
+	options.variableConditions = 3;
+	options.variables = 500;
+	options.squad = 20;
+	options.queries = 1000;
+	options.iterations = 200;
+	options.actionPercent = 25;
+	options.repeats = 1;
+	options.seed = 1;
+	options.statsPath = nullptr;
+	options.verify = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--verify") == 0)
+		{
+			options.verify = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--help") == 0 || i + 1 >= argc)
+			return false;
+
+		if (strcmp(argv[i], "--stats") == 0)
+		{
+			options.statsPath = argv[++i];
+			continue;
+		}
+
+		const int value = atoi(argv[++i]);
+		if (strcmp(argv[i - 1], "--lines") == 0) options.lines = value;
+		else if (strcmp(argv[i - 1], "--conditions") == 0) options.conditions = value;
+		else if (strcmp(argv[i - 1], "--variable-conditions") == 0) options.variableConditions = value;
+		else if (strcmp(argv[i - 1], "--variables") == 0) options.variables = value;
+		else if (strcmp(argv[i - 1], "--squad") == 0) options.squad = value;
+		else if (strcmp(argv[i - 1], "--queries") == 0) options.queries = value;
+		else if (strcmp(argv[i - 1], "--iterations") == 0) options.iterations = value;
+		else if (strcmp(argv[i - 1], "--action-percent") == 0) options.actionPercent = value;
+		else if (strcmp(argv[i - 1], "--repeats") == 0) options.repeats = value;
+		else if (strcmp(argv[i - 1], "--seed") == 0) options.seed = (unsigned)value;
+		else return false;
+	}
+	return options.variables > 0 && options.lines > 0 && options.squad > 0 && options.queries > 0 && options.iterations > 0
+		&& options.repeats > 0;
+}
+
+static GameData* newData(itemType type, const std::string& stringID)
+{
+	return ou->gamedata.createNewData(type, stringID, stringID);
+}
+
+static GameDataReference reference(GameData* target, int value)
+{
+	GameDataReference ref;
+	ref.sid = target->stringID;
+	ref.ptr = target;
+	ref.values[0] = value;
+	ref.values[1] = 0;
+	ref.values[2] = 0;
+	return ref;
+}
+
+static Character* newCharacter(std::mt19937& rng, Package& package)
+{
+	Character* character = new Character();
+	character->platoon = &package.platoon;
+	character->position = Ogre::Vector3((float)(rng() % 600), 0, (float)(rng() % 600));
+	for (int s = 0; s < STAT_END; ++s)
+	{
+		character->stats.unmodified[s] = (float)(rng() % 100);
+		character->stats.modified[s] = character->stats.unmodified[s] + (float)(rng() % 10);
+	}
+
+	// about half are unarmed, which is the slow weapon path
+	if (rng() % 2)
+	{
+		Weapon* weapon = new Weapon();
+		weapon->level = rng() % 80;
+		character->inventory->addItem(weapon);
+		character->currentWeapon = weapon;
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		Weapon* backup = new Weapon();
+		backup->level = rng() % 80;
+		character->inventory->addToSection(ATTACH_WEAPON, backup);
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		Armour* armour = new Armour();
+		armour->level = rng() % 80;
+		character->inventory->equipArmour(armour);
+	}
+	for (size_t i = 0; i < package.items.size(); ++i)
+	{
+		Item* stack = new Item();
+		stack->data = package.items[i];
+		stack->quantity = 1000000;
+		character->inventory->addItem(stack);
+	}
+	return character;
+}
+
+static void buildPackage(const Options& options, Package& package)
+{
+	std::mt19937 rng(options.seed);
+
+	for (int i = 0; i < 4; ++i)
+		package.items.push_back(newData(ITEM, "item-" + std::to_string(i)));
+
+	// speaker, target, then the rest of the speaker's squad around them
+	for (int i = 0; i < options.squad + 1; ++i)
+		package.characters.push_back(newCharacter(rng, package));
+	Character* me = package.characters[0];
+	Character* target = package.characters[1];
+	me->position = Ogre::Vector3(300, 0, 300);
+	for (int i = 0; i < options.squad; ++i)
+		package.platoon.members.push_back(package.characters[i == 0 ? 0 : i + 1]);
+	target->platoon = nullptr;
+	for (size_t i = 0; i < package.characters.size(); ++i)
+		package.characters[i]->memoryTags[std::make_pair(target, (int)ST_ANNOYED)] = rng() % 2;
+	package.dialogue.me = me;
+	package.dialogue.target = target;
+
+	std::vector<GameData*> variables;
+	for (int i = 0; i < options.variables; ++i)
+	{
+		GameData* variable = newData((itemType)VARIABLE_TYPE, "variable-" + std::to_string(i));
+		variable->idata["value"] = rng() % 10;
+		variables.push_back(variable);
+	}
+
+	static const char* variableConditions[] = { "variable equals", "variable less than", "variable greater than" };
+	static const int checkConditionKeys[] = { DC_IS_SLEEPING, DC_IS_ALLY_BECAUSE_OF_DISGUISE, DC_WEAPON_LEVEL, DC_ARMOUR_LEVEL };
+	static const int tagConditionKeys[] = { DC_HAS_SHORT_TERM_TAG, DC_STAT_LEVEL_UNMODIFIED, DC_STAT_LEVEL_MODIFIED };
+	static const TalkerEnum talkers[] = { T_ME, T_TARGET, T_WHOLE_SQUAD };
+
+	for (int l = 0; l < options.lines; ++l)
+	{
+		GameData* lineData = newData(DIALOGUE_LINE, "line-" + std::to_string(l));
+		DialogLineData* line = new DialogLineData();
+		line->data = lineData;
+
+		for (int c = 0; c < options.conditions; ++c)
+		{
+			const bool isTag = rng() % 2 != 0;
+			const int key = isTag ? tagConditionKeys[rng() % 3] : checkConditionKeys[rng() % 4];
+
+			DialogLineData::DialogCondition* condition = new DialogLineData::DialogCondition();
+			condition->key = (DialogConditionEnum)key;
+			condition->who = talkers[rng() % 3];
+			condition->tag = key == DC_HAS_SHORT_TERM_TAG ? (int)ST_ANNOYED : (int)(1 + rng() % (STAT_END - 1));
+			// mostly loose bounds so most lines get evaluated in full
+			condition->compareBy = rng() % 4 == 0 ? CE_EQUALS : (rng() % 2 ? CE_MORE_THAN : CE_LESS_THAN);
+			condition->value = condition->compareBy == CE_EQUALS ? (key == DC_IS_SLEEPING ? 0 : (int)(rng() % 2))
+				: condition->compareBy == CE_MORE_THAN ? -2 : 1000;
+			line->conditions.push_back(condition);
+
+			// the engine builds DialogCondition from these references
+			GameData* conditionData = newData(ITEM, lineData->stringID + "-condition-" + std::to_string(c));
+			conditionData->idata["condition name"] = key;
+			conditionData->idata["compare by"] = condition->compareBy;
+			conditionData->idata["who"] = condition->who;
+			conditionData->idata["tag"] = condition->tag;
+			lineData->objectReferences["conditions"].push_back(reference(conditionData, condition->value));
+		}
+
+		for (int v = 0; v < options.variableConditions; ++v)
+		{
+			const int kind = rng() % 3;
+			// equals is usually false, so keep those rare
+			const int value = kind == 0 ? (int)(rng() % 10) : kind == 1 ? 1000 : -1000;
+			if (kind == 0 && rng() % 8 != 0)
+				continue;
+			lineData->objectReferences[variableConditions[kind]].push_back(reference(variables[rng() % variables.size()], value));
+		}
+
+		if ((int)(rng() % 100) < options.actionPercent)
+		{
+			lineData->objectReferences[rng() % 2 ? "set variable" : "add to variable"].push_back(reference(variables[rng() % variables.size()], rng() % 3));
+			if (rng() % 4 == 0)
+				lineData->objectReferences["destroy item from squad"].push_back(reference(package.items[rng() % package.items.size()], 1));
+		}
+
+		package.lines.push_back(line);
+	}
+
+	for (int q = 0; q < options.queries; ++q)
+	{
+		GameData* stateData = newData(WORLD_EVENT_STATE, "state-" + std::to_string(q));
+		const int kind = rng() % 3;
+		stateData->objectReferences[variableConditions[kind]].push_back(reference(variables[rng() % variables.size()], kind == 0 ? (int)(rng() % 10) : kind == 1 ? -1000 : 1000));
+		package.queries.push_back(getFromData_hook(stateData));
+	}
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static void report(const char* name, Clock::time_point start, Clock::time_point end, long long evaluations, long long passed)
+{
+	const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	printf("%-18s %12lld evals %12.1f ns/eval", name, evaluations, ns / evaluations);
+	// passed is -1 for hooks without a result
+	if (passed >= 0)
+		printf(" %6.1f%% true", 100.0 * passed / evaluations);
+	printf("\n");
+}
+
+static void nextFrame()
+{
+	mainLoop_GPUSensitiveStuff_hook(ou, 1.0f / 60.0f);
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		usage();
+		return 1;
+	}
+
+	// registers conditions, the stub AddHook leaves the orig pointers alone
+	startPlugin();
+
+	DialogLineData_checkConditions_orig = &checkConditionsOrig;
+	checkTags_orig = &checkTagsOrig;
+	getFromData_orig = &getFromDataOrig;
+	WorldEventStateQuery_isTrue_orig = &isTrueOrig;
+	_doActions_orig = &doActionsOrig;
+	saveGameState_orig = &saveGameStateOrig;
+	loadAllPlatoons_orig = &loadAllPlatoonsOrig;
+	mainLoop_GPUSensitiveStuff_orig = &mainLoopOrig;
+
+	verifyConditionResults = options.verify;
+
+	// the plugin only enables stats before its hooks are installed
+	if (options.statsPath)
+		enableHookStats(options.statsPath, 1e9f);
+
+	ou = new GameWorld();
+	Package package;
+	buildPackage(options, package);
+
+	printf("%d lines x %d conditions + %d variable conditions, %d variables, squad of %d, %d queries, %d iterations\n",
+		options.lines, options.conditions, options.variableConditions, options.variables, options.squad, options.queries, options.iterations);
+
+	Character* me = package.dialogue.me;
+	Character* target = package.dialogue.target;
+	const long long lineEvaluations = (long long)options.lines * options.iterations;
+	const long long lineChecks = lineEvaluations * options.repeats;
+
+	// first use compiles lines, keep that out of the timings
+	for (size_t l = 0; l < package.lines.size(); ++l)
+	{
+		DialogLineData_checkConditions_hook(package.lines[l], &package.dialogue, target, false);
+		checkTags_hook(package.lines[l], me, target);
+	}
+
+	// every pass over the package is treated as one frame, like the engine evaluating candidate lines
+	long long passed = 0;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < options.iterations; ++i)
+	{
+		nextFrame();
+		for (size_t l = 0; l < package.lines.size(); ++l)
+			for (int r = 0; r < options.repeats; ++r)
+				passed += DialogLineData_checkConditions_hook(package.lines[l], &package.dialogue, target, false);
+	}
+	report("checkConditions", start, Clock::now(), lineChecks, passed);
+
+	passed = 0;
+	start = Clock::now();
+	for (int i = 0; i < options.iterations; ++i)
+	{
+		nextFrame();
+		for (size_t l = 0; l < package.lines.size(); ++l)
+			for (int r = 0; r < options.repeats; ++r)
+				passed += checkTags_hook(package.lines[l], me, target);
+	}
+	report("checkTags", start, Clock::now(), lineChecks, passed);
+
+	// interjections can have no target, by now the orders above have moved conditions on the target away from authoring order
+	passed = 0;
+	start = Clock::now();
+	for (int i = 0; i < options.iterations; ++i)
+	{
+		nextFrame();
+		for (size_t l = 0; l < package.lines.size(); ++l)
+			passed += checkTags_hook(package.lines[l], me, nullptr);
+	}
+	report("checkTags (null)", start, Clock::now(), lineEvaluations, passed);
+
+	passed = 0;
+	start = Clock::now();
+	for (int i = 0; i < options.iterations; ++i)
+	{
+		nextFrame();
+		for (size_t q = 0; q < package.queries.size(); ++q)
+			passed += WorldEventStateQuery_isTrue_hook(package.queries[q]);
+	}
+	report("isTrue", start, Clock::now(), (long long)options.queries * options.iterations, passed);
+
+	start = Clock::now();
+	for (int i = 0; i < options.iterations; ++i)
+	{
+		nextFrame();
+		for (size_t l = 0; l < package.lines.size(); ++l)
+			_doActions_hook(&package.dialogue, package.lines[l]);
+	}
+	report("_doActions", start, Clock::now(), lineEvaluations, -1);
+
+	// conversations check lines and apply the chosen one's effects, which must invalidate cached results
+	passed = 0;
+	start = Clock::now();
+	for (int i = 0; i < options.iterations; ++i)
+	{
+		nextFrame();
+		// lines are checked again after one is picked within the same frame
+		for (int sweep = 0; sweep < 2; ++sweep)
+		{
+			for (size_t l = 0; l < package.lines.size(); ++l)
+				for (int r = 0; r < options.repeats; ++r)
+					passed += DialogLineData_checkConditions_hook(package.lines[l], &package.dialogue, target, false)
+						&& checkTags_hook(package.lines[l], me, target);
+			if (sweep == 0)
+				for (size_t l = i % 16; l < package.lines.size(); l += 16)
+					_doActions_hook(&package.dialogue, package.lines[l]);
+		}
+	}
+	report("conversation", start, Clock::now(), lineChecks * 2, passed);
+
+	// isTrue again now variables have changed
+	passed = 0;
+	start = Clock::now();
+	for (size_t q = 0; q < package.queries.size(); ++q)
+		passed += WorldEventStateQuery_isTrue_hook(package.queries[q]);
+	report("isTrue (changed)", start, Clock::now(), (long long)options.queries, passed);
+
+	GameDataContainer save;
+	start = Clock::now();
+	saveGameState_hook(nullptr, &save);
+	report("save", start, Clock::now(), 1, -1);
+
+	// load the save back in
+	ou->savedata.clear();
+	for (ogre_unordered_map<std::string, GameData*>::type::iterator iter = save.gamedataSID.begin(); iter != save.gamedataSID.end(); ++iter)
+		ou->savedata.createNewData(iter->second->type, iter->first, iter->second->name)->updateFrom(iter->second, false);
+	start = Clock::now();
+	loadAllPlatoons_hook(ou);
+	report("load", start, Clock::now(), 1, -1);
+
+	if (options.statsPath)
+		dumpHookStats();
+
+	return 0;
+}
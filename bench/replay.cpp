@@ -0,0 +1,577 @@
+// Offline replay of a trace recorded with BFRIZZ_TRACE
+// Rebuilds the traced lines, world states, variables, squads and item stacks against the stand-ins in stubs/ and
+// calls the plugin's hooks in the recorded order. Extended conditions are answered from the results recorded with
+// each call and vanilla functions return what they returned in the game, so only the plugin's own logic is re-run:
+// compilation, ordering, caches, variables, squad scans and item effects. Reports calls whose result differs from the
+// game's, and the recorded and replayed time per hook. Replayed times don't include reading character state.
+//
+//   set BFRIZZ_TRACE=dialogue.trace before starting the game, then
+//   make bfrizz_replay && ./bfrizz_replay dialogue.trace
+
+#include <kenshi/StandIns.h>
+#include "../ConditionRegistry.h"
+#include "../HookStats.h"
+#include "../Trace.h"
+#include "../VariableStore.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// plugin hooks and the engine functions they forward to
+extern bool (*DialogLineData_checkConditions_orig)(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap);
+bool DialogLineData_checkConditions_hook(DialogLineData* thisptr, Dialogue* dialog, Character* target, bool isWordswap);
+extern bool (*checkTags_orig)(DialogLineData* thisptr, Character* me, Character* target);
+bool checkTags_hook(DialogLineData* thisptr, Character* me, Character* target);
+extern WorldEventStateQuery* (*getFromData_orig)(GameData* d);
+WorldEventStateQuery* getFromData_hook(GameData* d);
+extern bool (*WorldEventStateQuery_isTrue_orig)(WorldEventStateQuery* thisptr);
+bool WorldEventStateQuery_isTrue_hook(WorldEventStateQuery* thisptr);
+extern void (*_doActions_orig)(Dialogue* thisptr, DialogLineData* dialogLine);
+void _doActions_hook(Dialogue* thisptr, DialogLineData* dialogLine);
+extern void (*loadAllPlatoons_orig)(GameWorld* thisptr);
+void loadAllPlatoons_hook(GameWorld* thisptr);
+extern void (*mainLoop_GPUSensitiveStuff_orig)(GameWorld* thisptr, float time);
+void mainLoop_GPUSensitiveStuff_hook(GameWorld* thisptr, float time);
+void startPlugin();
+
+static const char* hookNames[HOOK_COUNT] = {
+	"getFromData",
+	"isTrue",
+	"checkConditions",
+	"checkTags",
+	"_doActions",
+	"saveGameState",
+	"loadAllPlatoons"
+};
+
+// mismatched calls printed in full
+static const int REPORTED_MISMATCHES = 10;
+
+struct FactKey
+{
+	int key;
+	int comparison;
+	Character* check;
+	Character* target;
+	int tag;
+	int value;
+
+	bool operator==(const FactKey& other) const
+	{
+		return key == other.key && comparison == other.comparison && check == other.check && target == other.target
+			&& tag == other.tag && value == other.value;
+	}
+};
+
+struct FactKeyHash
+{
+	size_t operator()(const FactKey& fact) const
+	{
+		size_t hash = std::hash<void*>()(fact.check) ^ (std::hash<void*>()(fact.target) << 1);
+		hash = hash * 31 + (size_t)fact.key;
+		hash = hash * 31 + (size_t)fact.comparison;
+		hash = hash * 31 + (size_t)fact.tag;
+		return hash * 31 + (size_t)fact.value;
+	}
+};
+
+// state of the call being read, cleared after each call
+static std::unordered_map<FactKey, bool, FactKeyHash> facts;
+static std::deque<bool> vanillaResults;
+static std::atomic<long long> missingFacts(0);
+static long long missingVanilla = 0;
+static long long unusedVanilla = 0;
+
+// answers extended conditions from the call's facts
+template<int Comparison>
+static bool replayFact(const ConditionType& type, Character* check, Character* target, int tag, int value)
+{
+	FactKey fact;
+	fact.key = (int)(&type - conditionTypes) + EXTENDED_CONDITION_BASE;
+	fact.comparison = Comparison;
+	fact.check = check;
+	fact.target = target;
+	fact.tag = tag;
+	fact.value = value;
+	std::unordered_map<FactKey, bool, FactKeyHash>::const_iterator iter = facts.find(fact);
+	if (iter == facts.end())
+	{
+		++missingFacts;
+		return false;
+	}
+	return iter->second;
+}
+
+static bool popVanilla()
+{
+	if (vanillaResults.empty())
+	{
+		++missingVanilla;
+		return true;
+	}
+	const bool result = vanillaResults.front();
+	vanillaResults.pop_front();
+	return result;
+}
+
+static bool checkConditionsOrig(DialogLineData*, Dialogue*, Character*, bool) { return popVanilla(); }
+static bool checkTagsOrig(DialogLineData*, Character*, Character*) { return popVanilla(); }
+static WorldEventStateQuery* getFromDataOrig(GameData* d) { return WorldEventStateQuery::getFromData(d); }
+static bool isTrueOrig(WorldEventStateQuery*) { return popVanilla(); }
+static void doActionsOrig(Dialogue*, DialogLineData*) {}
+static void loadAllPlatoonsOrig(GameWorld*) {}
+static void mainLoopOrig(GameWorld*, float) {}
+
+class TraceReader
+{
+public:
+	TraceReader(const std::vector<char>& bytes)
+		: bytes(bytes), position(0), truncated(false)
+	{
+	}
+
+	bool atEnd() const { return position >= bytes.size(); }
+	bool isTruncated() const { return truncated; }
+
+	uint32_t get8()
+	{
+		if (position + 1 > bytes.size())
+		{
+			truncated = true;
+			position = bytes.size();
+			return 0;
+		}
+		return (uint8_t)bytes[position++];
+	}
+
+	uint32_t get16()
+	{
+		const uint32_t low = get8();
+		return low | (get8() << 8);
+	}
+
+	uint32_t get32()
+	{
+		const uint32_t low = get16();
+		return low | (get16() << 16);
+	}
+
+	std::string getBytes(size_t length)
+	{
+		if (position + length > bytes.size())
+		{
+			truncated = true;
+			position = bytes.size();
+			return std::string();
+		}
+		std::string value(&bytes[position], length);
+		position += length;
+		return value;
+	}
+
+private:
+	const std::vector<char>& bytes;
+	size_t position;
+	bool truncated;
+};
+
+struct TracedData
+{
+	TracedData() : data(nullptr), line(nullptr), query(nullptr) {}
+
+	GameData* data;
+	std::vector<DialogLineData::DialogCondition> conditions;
+	// created when a hook is first called with the line
+	DialogLineData* line;
+	WorldEventStateQuery* query;
+};
+
+struct HookTotals
+{
+	long long calls;
+	long long mismatches;
+	double recordedNs;
+	double replayedNs;
+};
+
+class Replay
+{
+public:
+	Replay()
+		: calls(0)
+	{
+		memset(totals, 0, sizeof(totals));
+		// ids start at 1
+		strings.push_back(std::string());
+		data.push_back(TracedData());
+		characters.push_back(nullptr);
+		platoons.push_back(nullptr);
+	}
+
+	// returns false if the trace can't be read
+	bool run(TraceReader& reader)
+	{
+		if (reader.get8() != TR_HEADER || reader.getBytes(4) != "BFXT")
+		{
+			fprintf(stderr, "not a trace file\n");
+			return false;
+		}
+		const uint32_t version = reader.get32();
+		if (version != TRACE_VERSION)
+		{
+			fprintf(stderr, "trace version %u, expected %u\n", version, TRACE_VERSION);
+			return false;
+		}
+
+		while (!reader.atEnd())
+		{
+			const uint32_t type = reader.get8();
+			switch (type)
+			{
+				case TR_STRING: readString(reader); break;
+				case TR_DATA: readData(reader); break;
+				case TR_VARIABLES: readVariables(reader); break;
+				case TR_FRAME: mainLoop_GPUSensitiveStuff_hook(ou, 1.0f / 60.0f); break;
+				case TR_FACT: readFact(reader); break;
+				case TR_SQUAD: readSquad(reader); break;
+				case TR_ITEM_STACKS: readItemStacks(reader); break;
+				case TR_VANILLA: vanillaResults.push_back(reader.get8() != 0); break;
+				case TR_CALL: readCall(reader); break;
+				default:
+					fprintf(stderr, "unknown record type %u\n", type);
+					return false;
+			}
+		}
+		// a game that crashed or is still running leaves a partial record
+		if (reader.isTruncated())
+			fprintf(stderr, "trace is truncated, the last record was ignored\n");
+		return true;
+	}
+
+	// returns true if every call matched
+	bool report() const
+	{
+		printf("%-18s %12s %12s %14s %14s %12s %12s\n", "hook", "calls", "mismatches", "recorded ms", "replayed ms", "recorded ns", "replayed ns");
+		long long mismatches = 0;
+		for (int h = 0; h < HOOK_COUNT; ++h)
+		{
+			const HookTotals& hook = totals[h];
+			if (hook.calls == 0)
+				continue;
+			printf("%-18s %12lld %12lld %14.2f %14.2f %12.0f %12.0f\n", hookNames[h], hook.calls, hook.mismatches,
+				hook.recordedNs / 1e6, hook.replayedNs / 1e6, hook.recordedNs / hook.calls, hook.replayedNs / hook.calls);
+			mismatches += hook.mismatches;
+		}
+		// any of these mean the plugin's logic no longer asks the same questions the recorded build did
+		printf("missing condition results %lld, missing vanilla results %lld, unused vanilla results %lld\n",
+			missingFacts.load(), missingVanilla, unusedVanilla);
+		return mismatches == 0 && missingFacts.load() == 0 && missingVanilla == 0 && unusedVanilla == 0;
+	}
+
+private:
+	Character* getCharacter(uint32_t id)
+	{
+		if (id == TRACE_NONE)
+			return nullptr;
+		while (characters.size() <= id)
+		{
+			characters.push_back(new Character());
+			platoons.push_back(nullptr);
+		}
+		return characters[id];
+	}
+
+	TracedData& getData(uint32_t id)
+	{
+		if (id >= data.size())
+			data.resize(id + 1);
+		return data[id];
+	}
+
+	const std::string& getString(uint32_t id)
+	{
+		if (id >= strings.size())
+			strings.resize(id + 1);
+		return strings[id];
+	}
+
+	void readString(TraceReader& reader)
+	{
+		const uint32_t id = reader.get32();
+		const uint32_t length = reader.get16();
+		getString(id);
+		strings[id] = reader.getBytes(length);
+	}
+
+	void readData(TraceReader& reader)
+	{
+		const uint32_t id = reader.get32();
+		const std::string stringID = getString(reader.get32());
+		const int type = (int)reader.get32();
+		GameData* gameData = ou->gamedata.createNewData((itemType)type, stringID, stringID);
+
+		const uint32_t idataCount = reader.get16();
+		for (uint32_t i = 0; i < idataCount; ++i)
+		{
+			const std::string key = getString(reader.get32());
+			gameData->idata[key] = (int)reader.get32();
+		}
+
+		std::vector<DialogLineData::DialogCondition> conditions(reader.get16());
+		for (size_t i = 0; i < conditions.size(); ++i)
+		{
+			DialogLineData::DialogCondition& condition = conditions[i];
+			condition.key = (DialogConditionEnum)reader.get32();
+			condition.compareBy = (ComparisonEnum)reader.get8();
+			condition.who = (TalkerEnum)reader.get8();
+			condition.tag = (int)reader.get32();
+			condition.value = (int)reader.get32();
+		}
+
+		const uint32_t referenceCount = reader.get16();
+		for (uint32_t i = 0; i < referenceCount; ++i)
+		{
+			const std::string name = getString(reader.get32());
+			const uint32_t target = reader.get32();
+			GameDataReference ref;
+			ref.ptr = target == TRACE_NONE ? nullptr : getData(target).data;
+			ref.sid = ref.ptr ? ref.ptr->stringID : std::string();
+			ref.values[0] = (int)reader.get32();
+			ref.values[1] = 0;
+			ref.values[2] = 0;
+			gameData->objectReferences[name].push_back(ref);
+		}
+
+		TracedData& traced = getData(id);
+		traced.data = gameData;
+		traced.conditions.swap(conditions);
+		traced.line = nullptr;
+		traced.query = nullptr;
+	}
+
+	void readVariables(TraceReader& reader)
+	{
+		if (reader.get8())
+		{
+			// same invalidation as the game, nothing was saved so variables go back to their defaults
+			loadAllPlatoons_hook(ou);
+			// the game creates new queries after a load
+			for (size_t i = 0; i < data.size(); ++i)
+				data[i].query = nullptr;
+		}
+
+		const uint32_t count = reader.get32();
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			GameData* variable = getData(reader.get32()).data;
+			const bool hasValue = reader.get8() != 0;
+			const int value = (int)reader.get32();
+			if (!variable)
+				continue;
+			const int slot = variableStore.getSlot(variable);
+			if (hasValue)
+				variableStore.set(slot, value);
+		}
+	}
+
+	void readFact(TraceReader& reader)
+	{
+		FactKey fact;
+		fact.key = (int)reader.get32();
+		fact.comparison = (int)reader.get8();
+		fact.check = getCharacter(reader.get32());
+		fact.target = getCharacter(reader.get32());
+		fact.tag = (int)reader.get32();
+		fact.value = (int)reader.get32();
+		facts[fact] = reader.get8() != 0;
+	}
+
+	void readSquad(TraceReader& reader)
+	{
+		const uint32_t owner = reader.get32();
+		const bool hasPlatoon = reader.get8() != 0;
+		const uint32_t count = reader.get32();
+		Character* character = getCharacter(owner);
+
+		std::vector<Character*> members;
+		for (uint32_t i = 0; i < count; ++i)
+			members.push_back(getCharacter(reader.get32()));
+		if (!character)
+			return;
+
+		// everyone stands at the origin, so the squad scan finds exactly the recorded members
+		if (hasPlatoon)
+		{
+			if (!platoons[owner])
+				platoons[owner] = new ActivePlatoon();
+			platoons[owner]->members = members;
+		}
+		character->platoon = hasPlatoon ? platoons[owner] : nullptr;
+	}
+
+	void readItemStacks(TraceReader& reader)
+	{
+		Character* owner = getCharacter(reader.get32());
+		GameData* itemData = getData(reader.get32()).data;
+		const uint32_t count = reader.get32();
+
+		std::vector<int> quantities;
+		for (uint32_t i = 0; i < count; ++i)
+			quantities.push_back((int)reader.get32());
+		if (!owner)
+			return;
+
+		// replace whatever earlier effects left
+		lektor<Item*>& items = owner->inventory->getAllItems();
+		for (int i = items.size() - 1; i >= 0; --i)
+		{
+			Item* item = items[i];
+			if (item->data == itemData)
+			{
+				owner->inventory->removeItem(item);
+				delete item;
+			}
+		}
+		for (size_t i = 0; i < quantities.size(); ++i)
+		{
+			Item* stack = new Item();
+			stack->data = itemData;
+			stack->quantity = quantities[i];
+			owner->inventory->addItem(stack);
+		}
+	}
+
+	DialogLineData* getLine(TracedData& traced)
+	{
+		if (!traced.line)
+		{
+			traced.line = new DialogLineData();
+			traced.line->data = traced.data;
+			for (size_t i = 0; i < traced.conditions.size(); ++i)
+				traced.line->conditions.push_back(new DialogLineData::DialogCondition(traced.conditions[i]));
+		}
+		return traced.line;
+	}
+
+	void readCall(TraceReader& reader)
+	{
+		const uint32_t hook = reader.get8();
+		TracedData& traced = getData(reader.get32());
+		Character* me = getCharacter(reader.get32());
+		Character* target = getCharacter(reader.get32());
+		const bool wordswap = reader.get8() != 0;
+		const bool recorded = reader.get8() != 0;
+		const uint32_t ns = reader.get32();
+		if (reader.isTruncated() || hook >= HOOK_COUNT || !traced.data)
+			return;
+
+		Dialogue dialogue;
+		dialogue.me = me;
+		dialogue.target = target;
+
+		bool result = false;
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		switch (hook)
+		{
+			case HOOK_CHECK_CONDITIONS:
+				result = DialogLineData_checkConditions_hook(getLine(traced), &dialogue, target, wordswap);
+				break;
+			case HOOK_CHECK_TAGS:
+				result = checkTags_hook(getLine(traced), me, target);
+				break;
+			case HOOK_IS_TRUE:
+				if (!traced.query)
+					traced.query = getFromData_hook(traced.data);
+				result = WorldEventStateQuery_isTrue_hook(traced.query);
+				break;
+			case HOOK_DO_ACTIONS:
+				_doActions_hook(&dialogue, getLine(traced));
+				result = recorded;
+				break;
+		}
+		const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		HookTotals& hookTotals = totals[hook];
+		++hookTotals.calls;
+		hookTotals.recordedNs += ns;
+		hookTotals.replayedNs += (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		if (result != recorded)
+		{
+			if (hookTotals.mismatches++ < REPORTED_MISMATCHES)
+				printf("call %lld: %s on %s returned %d, the game returned %d\n", calls, hookNames[hook],
+					traced.data->stringID.c_str(), result ? 1 : 0, recorded ? 1 : 0);
+		}
+		++calls;
+
+		unusedVanilla += (long long)vanillaResults.size();
+		vanillaResults.clear();
+		facts.clear();
+	}
+
+	std::vector<std::string> strings;
+	std::vector<TracedData> data;
+	std::vector<Character*> characters;
+	// by owner, a squad is recorded for the character the scan was around
+	std::vector<ActivePlatoon*> platoons;
+	HookTotals totals[HOOK_COUNT];
+	long long calls;
+};
+
+int main(int argc, char** argv)
+{
+	if (argc != 2 || strcmp(argv[1], "--help") == 0)
+	{
+		printf("usage: bfrizz_replay TRACE\n");
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+	if (!file)
+	{
+		fprintf(stderr, "could not read %s\n", argv[1]);
+		return 1;
+	}
+	std::vector<char> bytes;
+	char buffer[65536];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		bytes.insert(bytes.end(), buffer, buffer + read);
+	fclose(file);
+
+	// registers conditions, the stub AddHook leaves the orig pointers alone
+	startPlugin();
+
+	DialogLineData_checkConditions_orig = &checkConditionsOrig;
+	checkTags_orig = &checkTagsOrig;
+	getFromData_orig = &getFromDataOrig;
+	WorldEventStateQuery_isTrue_orig = &isTrueOrig;
+	_doActions_orig = &doActionsOrig;
+	loadAllPlatoons_orig = &loadAllPlatoonsOrig;
+	mainLoop_GPUSensitiveStuff_orig = &mainLoopOrig;
+
+	// lines are compiled from these during the replay, so the recorded results are what they call
+	for (int i = 0; i < MAX_EXTENDED_CONDITIONS; ++i)
+	{
+		if (!conditionTypes[i].name)
+			continue;
+		conditionTypes[i].evaluators[0] = &replayFact<0>;
+		conditionTypes[i].evaluators[1] = &replayFact<1>;
+		conditionTypes[i].evaluators[2] = &replayFact<2>;
+		// whole squad fast paths read the stand-ins' stats, go through the members' recorded results instead
+		for (int c = 0; c < COMPARISON_COUNT; ++c)
+			conditionTypes[i].squadEvaluators[c] = nullptr;
+	}
+
+	ou = new GameWorld();
+	TraceReader reader(bytes);
+	Replay replay;
+	if (!replay.run(reader))
+		return 1;
+	return replay.report() ? 0 : 2;
+}
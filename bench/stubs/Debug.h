@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+void DebugLog(const std::string& message);
+void ErrorLog(const std::string& message);
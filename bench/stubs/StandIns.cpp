@@ -0,0 +1,246 @@
+#include <kenshi/StandIns.h>
+#include <Debug.h>
+
+#include <algorithm>
+#include <cstdio>
+
+GameWorld* ou = nullptr;
+
+static size_t errorCount = 0;
+
+void DebugLog(const std::string& message)
+{
+	(void)message;
+}
+
+void ErrorLog(const std::string& message)
+{
+	// only the first few, the benchmark loops would flood the output
+	if (errorCount++ < 10)
+		fprintf(stderr, "ErrorLog: %s\n", message.c_str());
+}
+
+void GameData::updateFrom(GameData* other, bool)
+{
+	idata = other->idata;
+	fdata = other->fdata;
+	bdata = other->bdata;
+	sdata = other->sdata;
+	objectReferences = other->objectReferences;
+}
+
+GameDataContainer::~GameDataContainer()
+{
+	clear();
+}
+
+GameData* GameDataContainer::createNewData(itemType type, const std::string& stringID, const std::string& name)
+{
+	GameData*& data = gamedataSID[stringID];
+	if (!data)
+		data = new GameData();
+	data->type = type;
+	data->stringID = stringID;
+	data->name = name;
+	return data;
+}
+
+void GameDataContainer::clear()
+{
+	for (ogre_unordered_map<std::string, GameData*>::type::iterator iter = gamedataSID.begin(); iter != gamedataSID.end(); ++iter)
+		delete iter->second;
+	gamedataSID.clear();
+}
+
+void GameDataManager::updateData(GameData* data, bool)
+{
+	GameData* existing = createNewData(data->type, data->stringID, data->name);
+	existing->updateFrom(data, false);
+}
+
+Inventory::Inventory()
+{
+	items.count = 0;
+	items.maxSize = 0;
+	items.stuff = nullptr;
+	for (int i = 0; i < ATTACH_SLOT_END; ++i)
+		sections[i].slot = (AttachSlot)i;
+}
+
+Inventory::~Inventory()
+{
+	for (int i = 0; i < items.size(); ++i)
+		delete items[i];
+	free(items.stuff);
+}
+
+Item* Inventory::getItem(GameData* data)
+{
+	for (int i = 0; i < items.size(); ++i)
+		if (items[i]->data == data)
+			return items[i];
+	return nullptr;
+}
+
+void Inventory::getAllSectionsOfType(lektor<InventorySection*>& out, AttachSlot slot)
+{
+	out.push_back(&sections[slot]);
+}
+
+void Inventory::getEquippedArmour(lektor<Item*>& out)
+{
+	for (size_t i = 0; i < armour.size(); ++i)
+		out.push_back(armour[i]);
+}
+
+void Inventory::addItem(Item* item)
+{
+	items.push_back(item);
+}
+
+void Inventory::removeItem(Item* item)
+{
+	Item** end = std::remove(items.begin(), items.end(), item);
+	items.count = (uint32_t)(end - items.begin());
+	armour.erase(std::remove(armour.begin(), armour.end(), (Item*)item), armour.end());
+	for (int s = 0; s < ATTACH_SLOT_END; ++s)
+		for (size_t i = 0; i < sections[s].items.size(); ++i)
+			if (sections[s].items[i].item == item)
+				sections[s].items.erase(sections[s].items.begin() + i--);
+}
+
+void Inventory::equipArmour(Armour* item)
+{
+	addItem(item);
+	armour.push_back(item);
+}
+
+void Inventory::addToSection(AttachSlot slot, Item* item)
+{
+	addItem(item);
+	InventorySection::SectionItem sectionItem;
+	sectionItem.item = item;
+	sectionItem.x = 0;
+	sectionItem.y = 0;
+	sections[slot].items.push_back(sectionItem);
+}
+
+CharStats::CharStats()
+{
+	for (int i = 0; i < STAT_END; ++i)
+	{
+		modified[i] = 0;
+		unmodified[i] = 0;
+	}
+}
+
+float CharStats::getStat(StatsEnumerated stat, bool useUnmodified)
+{
+	return useUnmodified ? unmodified[stat] : modified[stat];
+}
+
+Character::Character()
+	: inSomething(NOT_IN_ANYTHING), inventory(new Inventory()), platoon(nullptr), position(0, 0, 0),
+	currentWeapon(nullptr), preferredWeapon(nullptr)
+{
+}
+
+Character::~Character()
+{
+	delete inventory;
+}
+
+bool Character::isAlly(Character* other, bool includeDisguise)
+{
+	if (std::find(allies.begin(), allies.end(), other) != allies.end())
+		return true;
+	return includeDisguise && std::find(disguisedAllies.begin(), disguisedAllies.end(), other) != disguisedAllies.end();
+}
+
+int Character::getCharacterMemoryTag(Character* other, CharacterPerceptionTags_ShortTerm tag)
+{
+	std::map<std::pair<Character*, int>, int>::iterator iter = memoryTags.find(std::make_pair(other, (int)tag));
+	return iter == memoryTags.end() ? 0 : iter->second;
+}
+
+void Character::giveItem(Item* item, bool, bool)
+{
+	inventory->addItem(item);
+}
+
+void Character::dropItem(Item* item)
+{
+	inventory->removeItem(item);
+}
+
+void ActivePlatoon::getCharactersInArea(lektor<RootObject*>& out, const Ogre::Vector3& position, float radius, bool)
+{
+	for (size_t i = 0; i < members.size(); ++i)
+		if (members[i]->position.squaredDistance(position) <= radius * radius)
+			out.push_back(members[i]);
+}
+
+Item* RootObjectFactory::copyItem(Item* item)
+{
+	Item* copy = new Item();
+	copy->data = item->data;
+	copy->quantity = item->quantity;
+	copy->level = item->level;
+	return copy;
+}
+
+GameWorld::GameWorld()
+	: theFactory(new RootObjectFactory())
+{
+}
+
+void GameWorld::destroy(RootObject* object, bool, const std::string&)
+{
+	delete object;
+}
+
+// engine functions the plugin hooks, the benchmark calls the hooks directly
+
+void GameWorld::loadAllPlatoons()
+{
+}
+
+void GameWorld::_NV_mainLoop_GPUSensitiveStuff(float)
+{
+}
+
+void Dialogue::_doActions(DialogLineData*)
+{
+}
+
+DialogLineData::DialogLineData()
+	: data(nullptr)
+{
+	conditions.count = 0;
+	conditions.maxSize = 0;
+	conditions.stuff = nullptr;
+}
+
+bool DialogLineData::checkConditions(Dialogue*, Character*, bool)
+{
+	return true;
+}
+
+bool DialogLineData::checkTags(Character*, Character*)
+{
+	return true;
+}
+
+WorldEventStateQuery* WorldEventStateQuery::getFromData(GameData*)
+{
+	return new WorldEventStateQuery();
+}
+
+bool WorldEventStateQuery::isTrue()
+{
+	return true;
+}
+
+void FactionManager::saveGameState(GameDataContainer*)
+{
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// hooks aren't installed on the host, the benchmark sets the _orig pointers itself
+namespace KenshiLib
+{
+	enum HookStatus
+	{
+		SUCCESS,
+		FAILURE
+	};
+
+	template<typename F>
+	void* GetRealAddress(F)
+	{
+		return nullptr;
+	}
+
+	template<typename Hook, typename Orig>
+	HookStatus AddHook(void*, Hook, Orig)
+	{
+		return SUCCESS;
+	}
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+// Lightweight stand-ins for the KenshiLib types the plugin uses, so its logic can be built and benchmarked on a
+// host machine. Only the members the plugin touches exist, and behaviour is the simplest data-driven version of
+// the engine's. Layouts and enum values don't match the game.
+
+#include <cstdlib>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <kenshi/util/lektor.h>
+
+#ifndef _MSC_VER
+#define __declspec(x)
+#endif
+
+namespace Ogre
+{
+	template<class T>
+	struct vector
+	{
+		typedef std::vector<T> type;
+	};
+
+	struct Vector3
+	{
+		float x, y, z;
+
+		Vector3() {}
+		Vector3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+		bool operator==(const Vector3& other) const { return x == other.x && y == other.y && z == other.z; }
+		bool operator!=(const Vector3& other) const { return !(*this == other); }
+		float squaredDistance(const Vector3& other) const
+		{
+			return (x - other.x) * (x - other.x) + (y - other.y) * (y - other.y) + (z - other.z) * (z - other.z);
+		}
+	};
+}
+
+template<class K, class V>
+struct ogre_unordered_map
+{
+	typedef boost::unordered_map<K, V> type;
+};
+
+enum itemType
+{
+	ITEM = 0,
+	CHARACTER = 1,
+	DIALOGUE_LINE = 19,
+	WORLD_EVENT_STATE = 63
+};
+
+enum ComparisonEnum
+{
+	CE_EQUALS,
+	CE_LESS_THAN,
+	CE_MORE_THAN
+};
+
+enum TalkerEnum
+{
+	T_ME,
+	T_TARGET,
+	T_TARGET_IF_PLAYER,
+	T_INTERJECTOR1,
+	T_INTERJECTOR2,
+	T_INTERJECTOR3,
+	T_WHOLE_SQUAD
+};
+
+enum UseStuffState
+{
+	NOT_IN_ANYTHING,
+	IN_BED,
+	IN_CAGE
+};
+
+enum AttachSlot
+{
+	ATTACH_WEAPON,
+	ATTACH_BACK,
+	ATTACH_BELT,
+	ATTACH_SLOT_END
+};
+
+enum StatsEnumerated
+{
+	STAT_NONE,
+	STAT_STRENGTH,
+	STAT_DEXTERITY,
+	STAT_TOUGHNESS,
+	STAT_PERCEPTION,
+	STAT_ATHLETICS,
+	STAT_END
+};
+
+enum CharacterPerceptionTags_ShortTerm
+{
+	ST_NONE,
+	ST_ANNOYED,
+	ST_SUSPICIOUS,
+	ST_END
+};
+
+enum DialogConditionEnum
+{
+	DC_NONE,
+	DC_PERSONALITY_TAG
+};
+
+class GameData;
+
+struct GameDataReference
+{
+	std::string sid;
+	GameData* ptr;
+	int values[3];
+};
+
+class GameData
+{
+public:
+	itemType type;
+	std::string stringID;
+	std::string name;
+	ogre_unordered_map<std::string, int>::type idata;
+	ogre_unordered_map<std::string, float>::type fdata;
+	ogre_unordered_map<std::string, bool>::type bdata;
+	ogre_unordered_map<std::string, std::string>::type sdata;
+	ogre_unordered_map<std::string, Ogre::vector<GameDataReference>::type>::type objectReferences;
+
+	GameData() : type(ITEM) {}
+	void updateFrom(GameData* other, bool);
+};
+
+class GameDataContainer
+{
+public:
+	ogre_unordered_map<std::string, GameData*>::type gamedataSID;
+
+	~GameDataContainer();
+	GameData* createNewData(itemType type, const std::string& stringID, const std::string& name);
+	void clear();
+};
+
+class GameDataManager : public GameDataContainer
+{
+public:
+	void updateData(GameData* data, bool);
+};
+
+class Inventory;
+class ActivePlatoon;
+class CharStats;
+class Item;
+class Weapon;
+
+class RootObject
+{
+public:
+	GameData* data;
+
+	RootObject() : data(nullptr) {}
+	virtual ~RootObject() {}
+};
+
+class Item : public RootObject
+{
+public:
+	int quantity;
+	int level;
+
+	Item() : quantity(1), level(0) {}
+	int getLevel() { return level; }
+};
+
+class Weapon : public Item
+{
+};
+
+class Armour : public Item
+{
+};
+
+class InventorySection
+{
+public:
+	struct SectionItem
+	{
+		Item* item;
+		int x, y;
+	};
+
+	AttachSlot slot;
+	Ogre::vector<SectionItem>::type items;
+
+	const Ogre::vector<SectionItem>::type& getItems() { return items; }
+};
+
+class Inventory
+{
+public:
+	Inventory();
+	~Inventory();
+
+	Item* getItem(GameData* data);
+	void getAllSectionsOfType(lektor<InventorySection*>& out, AttachSlot slot);
+	void getEquippedArmour(lektor<Item*>& out);
+	lektor<Item*>& getAllItems() { return items; }
+
+	// stand-in helpers
+	void addItem(Item* item);
+	void removeItem(Item* item);
+	void equipArmour(Armour* armour);
+	void addToSection(AttachSlot slot, Item* item);
+
+private:
+	lektor<Item*> items;
+	std::vector<Item*> armour;
+	InventorySection sections[ATTACH_SLOT_END];
+};
+
+class CharStats
+{
+public:
+	float modified[STAT_END];
+	float unmodified[STAT_END];
+
+	CharStats();
+	float getStat(StatsEnumerated stat, bool unmodified);
+};
+
+class Character : public RootObject
+{
+public:
+	UseStuffState inSomething;
+	Inventory* inventory;
+
+	// stand-in state
+	CharStats stats;
+	ActivePlatoon* platoon;
+	Ogre::Vector3 position;
+	Weapon* currentWeapon;
+	Weapon* preferredWeapon;
+	std::map<std::pair<Character*, int>, int> memoryTags;
+	std::vector<Character*> allies;
+	std::vector<Character*> disguisedAllies;
+
+	Character();
+	~Character();
+
+	bool isAlly(Character* other, bool includeDisguise);
+	Weapon* getCurrentWeapon() { return currentWeapon; }
+	Weapon* getThePreferredWeapon() { return preferredWeapon; }
+	Inventory* getInventory() { return inventory; }
+	ActivePlatoon* getPlatoon() { return platoon; }
+	const Ogre::Vector3& getPosition() { return position; }
+	int getCharacterMemoryTag(Character* other, CharacterPerceptionTags_ShortTerm tag);
+	CharStats* getStats() { return &stats; }
+	void giveItem(Item* item, bool, bool);
+	void dropItem(Item* item);
+};
+
+class ActivePlatoon
+{
+public:
+	std::vector<Character*> members;
+
+	void getCharactersInArea(lektor<RootObject*>& out, const Ogre::Vector3& position, float radius, bool);
+};
+
+class RootObjectFactory
+{
+public:
+	Item* copyItem(Item* item);
+};
+
+class GameWorld
+{
+public:
+	GameDataManager gamedata;
+	GameDataManager savedata;
+	RootObjectFactory* theFactory;
+
+	GameWorld();
+	void destroy(RootObject* object, bool, const std::string& reason);
+	void loadAllPlatoons();
+	void _NV_mainLoop_GPUSensitiveStuff(float time);
+};
+
+extern GameWorld* ou;
+
+class DialogLineData;
+
+class hand
+{
+public:
+	Character* character;
+
+	Character* getCharacter() { return character; }
+};
+
+class Dialogue
+{
+public:
+	Character* me;
+	Character* target;
+
+	Character* getCharacter() { return me; }
+	hand getConversationTarget() { hand h; h.character = target; return h; }
+	void _doActions(DialogLineData* line);
+};
+
+class DialogLineData
+{
+public:
+	struct DialogCondition
+	{
+		DialogConditionEnum key;
+		ComparisonEnum compareBy;
+		TalkerEnum who;
+		int value;
+		int tag;
+	};
+
+	lektor<DialogCondition*> conditions;
+	GameData* data;
+
+	DialogLineData();
+	GameData* getGameData() { return data; }
+	bool checkConditions(Dialogue* dialog, Character* target, bool isWordswap);
+	bool checkTags(Character* me, Character* target);
+};
+
+class WorldEventStateQuery
+{
+public:
+	static WorldEventStateQuery* getFromData(GameData* data);
+	bool isTrue();
+};
+
+class FactionManager
+{
+public:
+	void saveGameState(GameDataContainer* container);
+};
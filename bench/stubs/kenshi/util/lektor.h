@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+
+// stand-in for the engine's growable array, grown with realloc and released with free by its users
+template<typename T>
+class lektor
+{
+public:
+	virtual ~lektor() {}
+
+	uint32_t count;
+	uint32_t maxSize;
+	T* stuff;
+
+	int size() const { return (int)count; }
+	T& operator[](int i) { return stuff[i]; }
+	const T& operator[](int i) const { return stuff[i]; }
+	T* begin() { return stuff; }
+	T* end() { return stuff + count; }
+
+	void push_back(const T& value)
+	{
+		if (count >= maxSize)
+		{
+			maxSize = maxSize ? maxSize * 2 : 8;
+			stuff = (T*)realloc(stuff, maxSize * sizeof(T));
+		}
+		stuff[count++] = value;
+	}
+};